@@ -0,0 +1,2 @@
+\ the generated compile.fs from blocks, run with -b compile.fs: no copying into input_buffer
+0 3F thru
@@ -0,0 +1,4 @@
+\ doubly recursive fibonacci, mostly DOCOL / EXIT and short primitives
+\ numbers are hex, 19 fib is 12511
+: fib ( n -- fib ) dup 2 < if else dup 1 - fib swap 2 - fib + then ;
+19 fib u.
@@ -0,0 +1,9 @@
+\ Q16.16 low-pass filter and gcds, mostly q* and the divider
+\ numbers are hex, 1000 run is 7.FC59 and 400 gcds is 180600
+: signal ( i -- q ) 3F and s>q ;
+: smooth ( avg x -- avg' ) over - 2000 q* + ;
+: run ( n -- avg ) 0 swap begin swap over signal smooth swap 1 - dup 0= until drop ;
+: gcd ( a b -- gcd ) begin dup while swap over mod repeat drop ;
+: gcds ( n -- sum ) 0 swap begin dup dup 9E37 * swap 79B9 * gcd rot + swap 1 - dup 0= until drop ;
+1000 run q.
+400 gcds u.
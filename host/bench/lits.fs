@@ -0,0 +1,4 @@
+\ literal-heavy inner loop, mostly LIT and arithmetic
+: lits ( -- ) 0 1 + 2 + 3 - 4 + 5 - 6 + 7 - 8 + 9 - a + b - c + d - e + f - drop ;
+: run ( n -- ) begin lits 1 - dup 0= until drop ;
+2000 run
@@ -0,0 +1,2 @@
+\ prepended to a benchmark to compile it to native code instead of threaded code
+native
@@ -0,0 +1,11 @@
+\ sieve of Eratosthenes on the bytes after here, memory access and branches
+\ numbers are hex, there are 404 primes below 2000
+: N 2000 ;
+: flags ( -- addr ) here ;
+: clear ( -- ) 0 begin dup flags + 1 swap c! 1 + dup N = until drop ;
+: mark ( step i -- ) begin dup N < while dup flags + 0 swap c! over + repeat drop drop ;
+: sieve ( -- count )
+  clear 0 2 begin dup N < while
+    dup flags + c@ if swap 1 + swap dup dup dup + mark then
+  1 + repeat drop ;
+sieve u.
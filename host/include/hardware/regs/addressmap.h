@@ -0,0 +1,3 @@
+// Stand-in for the pico-sdk header of the same name, only what picoforth.S uses
+
+#define SIO_BASE 0xd0000000
@@ -0,0 +1,9 @@
+// Stand-in for the pico-sdk header of the same name, only what picoforth.S uses
+
+#define SIO_DIV_UDIVIDEND_OFFSET 0x00000060
+#define SIO_DIV_UDIVISOR_OFFSET 0x00000064
+#define SIO_DIV_SDIVIDEND_OFFSET 0x00000068
+#define SIO_DIV_SDIVISOR_OFFSET 0x0000006c
+#define SIO_DIV_QUOTIENT_OFFSET 0x00000070
+#define SIO_DIV_REMAINDER_OFFSET 0x00000074
+#define SIO_DIV_CSR_OFFSET 0x00000078
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+
+// ELF32 structures as far as we need them, spelled out so that we don't depend on <elf.h>
+struct elf_header {
+    uint8_t ident[16];
+    uint16_t type, machine;
+    uint32_t version, entry, phoff, shoff, flags;
+    uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+};
+
+struct elf_section {
+    uint32_t name, type, flags, addr, offset, size, link, info, addralign, entsize;
+};
+
+struct elf_symbol {
+    uint32_t name, value, size;
+    uint8_t info, other;
+    uint16_t shndx;
+};
+
+struct elf_rel {
+    uint32_t offset, info;
+};
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_NOBITS 8
+#define SHT_REL 9
+#define SHF_ALLOC 2
+#define SHN_UNDEF 0
+#define SHN_ABS 0xfff1
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define EM_ARM 40
+
+#define R_ARM_NONE 0
+#define R_ARM_ABS32 2
+#define R_ARM_REL32 3
+#define R_ARM_THM_CALL 10
+#define R_ARM_THM_JUMP11 102
+#define R_ARM_THM_JUMP8 103
+
+#define FLASH_LOAD_ADDR (FLASH_BASE + 0x100) // after the boot stage 2
+#define SCRATCH_X_BASE (SRAM_BASE + 0x40000) // the two 4KB banks at the end of SRAM
+#define SCRATCH_Y_BASE (SRAM_BASE + 0x41000)
+#define VENEER_SIZE 16
+
+static void fail(const char *path, const char *msg, const char *detail) {
+    fprintf(stderr, "%s: %s%s%s\n", path, msg, detail ? " " : "", detail ? detail : "");
+    exit(2);
+}
+
+static uint32_t align(uint32_t v, uint32_t a) {
+    return a > 1 ? (v + a - 1) & ~(a - 1) : v;
+}
+
+static bool in_flash(const char *name) {
+    return !strncmp(name, ".text", 5) || !strncmp(name, ".rodata", 7);
+}
+
+// an area after the placed sections, where stubs and veneers are put
+struct region {
+    uint32_t stubs; // `udf #n` for every hostcall, 2 bytes each
+    uint32_t next;  // next free byte for veneers
+};
+
+static void put16(struct cpu *c, uint32_t addr, uint16_t v) {
+    uint8_t *p = mem_ptr(c, addr, 2);
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static uint16_t get16(struct cpu *c, uint32_t addr) {
+    uint8_t *p = mem_ptr(c, addr, 2);
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t veneer(struct cpu *c, struct region *r, uint32_t target) {
+    // push {r0}; ldr r0, [pc, #8]; mov ip, r0; pop {r0}; bx ip; nop; .word target
+    static const uint16_t code[] = { 0xb401, 0x4802, 0x4684, 0xbc01, 0x4760, 0xbf00 };
+    uint32_t at = align(r->next, 4);
+    for (size_t i = 0; i < 6; i++)
+        put16(c, at + 2 * i, code[i]);
+    mem_write32(c, at + 12, target | 1);
+    r->next = at + VENEER_SIZE;
+    return at;
+}
+
+static int32_t decode_bl(uint16_t hi, uint16_t lo) {
+    uint32_t s = (hi >> 10) & 1;
+    uint32_t i1 = !(((lo >> 13) & 1) ^ s), i2 = !(((lo >> 11) & 1) ^ s);
+    uint32_t imm = s << 24 | i1 << 23 | i2 << 22 | (hi & 0x3ff) << 12 | (lo & 0x7ff) << 1;
+    if (s) imm |= 0xfe000000u;
+    return (int32_t)imm;
+}
+
+static bool encode_bl(struct cpu *c, uint32_t at, int32_t offset) {
+    if (offset < -(1 << 24) || offset >= (1 << 24))
+        return false;
+    uint32_t imm = (uint32_t)offset;
+    uint32_t s = (imm >> 24) & 1;
+    uint32_t j1 = !(((imm >> 23) & 1) ^ s), j2 = !(((imm >> 22) & 1) ^ s);
+    put16(c, at, 0xf000 | s << 10 | ((imm >> 12) & 0x3ff));
+    put16(c, at + 2, 0xd000 | j1 << 13 | j2 << 11 | ((imm >> 1) & 0x7ff));
+    return true;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    const struct symbol *sa = a, *sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+void load_object(struct cpu *c, const char *path, const char *const *hostcalls, size_t hostcall_count,
+                 const struct host_data *data, size_t data_count, struct image *img) {
+    FILE *f = fopen(path, "rb");
+    if (!f) fail(path, "cannot open", NULL);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(size);
+    if (fread(buf, 1, size, f) != (size_t)size) fail(path, "cannot read", NULL);
+    fclose(f);
+
+    struct elf_header *eh = (struct elf_header *)buf;
+    if (memcmp(eh->ident, "\x7f" "ELF", 4) || eh->ident[4] != 1 || eh->machine != EM_ARM || eh->type != 1)
+        fail(path, "not a 32 bit ARM relocatable object", NULL);
+
+    struct elf_section *sh = (struct elf_section *)(buf + eh->shoff);
+    const char *shstr = (const char *)buf + sh[eh->shstrndx].offset;
+    uint32_t *base = calloc(eh->shnum, sizeof(uint32_t)); // load address per section, 0 if not loaded
+
+    // place sections
+    uint32_t flash_at = FLASH_LOAD_ADDR, sram_at = SRAM_BASE, scratch_x_at = SCRATCH_X_BASE;
+    for (int i = 0; i < eh->shnum; i++) {
+        if (!(sh[i].flags & SHF_ALLOC) || !sh[i].size) continue;
+        const char *name = shstr + sh[i].name;
+        uint32_t *at = in_flash(name) ? &flash_at : !strncmp(name, ".scratch_x", 10) ? &scratch_x_at : &sram_at;
+        *at = align(*at, sh[i].addralign);
+        base[i] = *at;
+        uint8_t *dest = mem_ptr(c, *at, 1);
+        if (!dest || !mem_ptr(c, *at + sh[i].size - 1, 1)) fail(path, "section does not fit:", name);
+        if (sh[i].type == SHT_NOBITS) memset(dest, 0, sh[i].size);
+        else memcpy(dest, buf + sh[i].offset, sh[i].size);
+        *at += sh[i].size;
+    }
+
+    struct region flash = { .stubs = align(flash_at, 4) }, sram = { .stubs = align(sram_at, 4) };
+    for (size_t n = 0; n < hostcall_count; n++) {
+        put16(c, flash.stubs + 2 * n, 0xde00 | n);
+        put16(c, sram.stubs + 2 * n, 0xde00 | n);
+    }
+    flash.next = flash.stubs + 2 * hostcall_count;
+    sram.next = sram.stubs + 2 * hostcall_count;
+    uint32_t *data_addr = calloc(data_count + 1, sizeof(uint32_t));
+    for (size_t n = 0; n < data_count; n++) {
+        sram.next = align(sram.next, 4);
+        data_addr[n] = sram.next;
+        memset(mem_ptr(c, sram.next, 1), 0, data[n].size);
+        sram.next += data[n].size;
+    }
+
+    // symbols and relocations
+    img->symbols = NULL;
+    img->symbol_count = 0;
+    for (int s = 0; s < eh->shnum; s++) {
+        if (sh[s].type != SHT_SYMTAB) continue;
+        struct elf_symbol *syms = (struct elf_symbol *)(buf + sh[s].offset);
+        size_t nsyms = sh[s].size / sizeof(struct elf_symbol);
+        const char *strtab = (const char *)buf + sh[sh[s].link].offset;
+
+        img->symbols = realloc(img->symbols, (img->symbol_count + nsyms) * sizeof(struct symbol));
+        for (size_t i = 0; i < nsyms; i++) {
+            uint16_t shndx = syms[i].shndx;
+            const char *name = strtab + syms[i].name;
+            if (!*name || (syms[i].info & 15) == STT_SECTION || shndx == SHN_UNDEF || shndx >= eh->shnum
+                || !base[shndx] || name[0] == '$')
+                continue;
+            img->symbols[img->symbol_count++] = (struct symbol) { name, base[shndx] + (syms[i].value & ~1u) };
+        }
+
+        for (int r = 0; r < eh->shnum; r++) {
+            if (sh[r].type != SHT_REL || sh[r].link != (uint32_t)s || !base[sh[r].info]) continue;
+            int target = sh[r].info;
+            struct region *region = in_flash(shstr + sh[target].name) ? &flash : &sram;
+            struct elf_rel *rel = (struct elf_rel *)(buf + sh[r].offset);
+            for (size_t i = 0; i < sh[r].size / sizeof(struct elf_rel); i++) {
+                struct elf_symbol *sym = &syms[rel[i].info >> 8];
+                uint8_t type = rel[i].info & 0xff;
+                uint32_t p = base[target] + rel[i].offset;
+                const char *name = strtab + sym->name;
+
+                uint32_t s_addr, t = 0;
+                bool hostcall = false;
+                if (sym->shndx == SHN_UNDEF) {
+                    size_t n;
+                    for (n = 0; n < hostcall_count && strcmp(hostcalls[n], name); n++);
+                    if (n < hostcall_count) {
+                        hostcall = true;
+                        s_addr = region->stubs + 2 * n;
+                        t = 1;
+                    } else {
+                        for (n = 0; n < data_count && strcmp(data[n].name, name); n++);
+                        if (n == data_count) fail(path, "undefined symbol", name);
+                        s_addr = data_addr[n];
+                    }
+                } else if (sym->shndx == SHN_ABS) {
+                    s_addr = sym->value;
+                } else {
+                    if (!base[sym->shndx]) fail(path, "reference to unloaded section from", name);
+                    s_addr = base[sym->shndx] + (sym->value & ~1u);
+                    t = (sym->info & 15) == STT_FUNC && (sym->value & 1);
+                }
+
+                switch (type) {
+                case R_ARM_NONE:
+                    break;
+                case R_ARM_ABS32:
+                    mem_write32(c, p, (s_addr + mem_read32(c, p)) | t);
+                    break;
+                case R_ARM_REL32:
+                    mem_write32(c, p, s_addr + mem_read32(c, p) - p);
+                    break;
+                case R_ARM_THM_CALL: {
+                    int32_t a = decode_bl(get16(c, p), get16(c, p + 2));
+                    if (!encode_bl(c, p, (int32_t)(s_addr + a - p))) {
+                        if (hostcall) fail(path, "hostcall stub out of range for", name);
+                        encode_bl(c, p, (int32_t)(veneer(c, region, s_addr) + a - p));
+                    }
+                    break;
+                }
+                case R_ARM_THM_JUMP11: {
+                    uint16_t op = get16(c, p);
+                    int32_t a = (int32_t)((op & 0x7ff) << 21) >> 20;
+                    int32_t off = (int32_t)(s_addr + a - p);
+                    if (off < -2048 || off >= 2048) fail(path, "branch out of range to", name);
+                    put16(c, p, (op & 0xf800) | ((off >> 1) & 0x7ff));
+                    break;
+                }
+                case R_ARM_THM_JUMP8: {
+                    uint16_t op = get16(c, p);
+                    int32_t a = (int32_t)((op & 0xff) << 24) >> 23;
+                    int32_t off = (int32_t)(s_addr + a - p);
+                    if (off < -256 || off >= 256) fail(path, "branch out of range to", name);
+                    put16(c, p, (op & 0xff00) | ((off >> 1) & 0xff));
+                    break;
+                }
+                default: {
+                    char detail[64];
+                    snprintf(detail, sizeof(detail), "%d against %s", type, name);
+                    fail(path, "unsupported relocation", detail);
+                }
+                }
+            }
+        }
+    }
+    qsort(img->symbols, img->symbol_count, sizeof(struct symbol), compare_symbols);
+    img->hostcall_stubs = flash.stubs;
+    img->sram_end = align(sram.next, 4);
+    if (flash.next > FLASH_BASE + FLASH_SIZE) fail(path, "flash overflow", NULL);
+    if (img->sram_end > SCRATCH_X_BASE) fail(path, "SRAM overflow", NULL);
+    if (scratch_x_at > SCRATCH_Y_BASE) fail(path, "scratch X overflow", NULL);
+
+    // the names point into buf, so it has to stay around
+    free(base);
+    free(data_addr);
+}
+
+uint32_t image_symbol(const struct image *img, const char *name) {
+    for (size_t i = 0; i < img->symbol_count; i++)
+        if (!strcmp(img->symbols[i].name, name))
+            return img->symbols[i].addr;
+    return 0;
+}
+
+const struct symbol *image_symbol_at(const struct image *img, uint32_t addr) {
+    size_t lo = 0, hi = img->symbol_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (img->symbols[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo ? &img->symbols[lo - 1] : NULL;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "thumb.h"
+
+// A minimal linker for the relocatable object assembled from picoforth.S. Sections are placed
+// where the RP2040 linker script would put them (code into flash, .data and friends into SRAM,
+// .scratch_x into its bank), calls to undefined functions are bound to `udf #n` stubs that the
+// emulator hands to the host.
+
+struct symbol {
+    const char *name;
+    uint32_t addr; // without the thumb bit
+};
+
+struct image {
+    struct symbol *symbols; // sorted by address
+    size_t symbol_count;
+    uint32_t hostcall_stubs; // `udf #n` for hostcall n is at hostcall_stubs + 2 * n
+    uint32_t sram_end;       // first free byte after everything placed in SRAM
+};
+
+struct host_data {
+    const char *name;
+    uint32_t size;
+};
+
+// hostcalls[n] is bound to `udf #n`, data symbols are allocated zeroed in SRAM
+void load_object(struct cpu *c, const char *path, const char *const *hostcalls, size_t hostcall_count,
+                 const struct host_data *data, size_t data_count, struct image *img);
+
+// returns 0 if there is no such symbol
+uint32_t image_symbol(const struct image *img, const char *name);
+// the symbol containing addr, NULL if none
+const struct symbol *image_symbol_at(const struct image *img, uint32_t addr);
@@ -0,0 +1,692 @@
+// picoforth_host: runs picoforth.S on an emulated Cortex-M0+ with the C side of picoforth.c
+// replaced by host functions. Source is read line by line from the files given on the command
+// line (or stdin), output goes to stdout and a performance report to stderr.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loader.h"
+#include "thumb.h"
+
+#define CPU_MHZ 125 // the RP2040's default clock, for converting cycles to time
+
+static struct cpu cpu;
+static struct image img;
+static bool quiet = false;
+
+static char **inputs;
+static int input_count;
+static int input_next = 0;
+static FILE *input = NULL;
+
+// performance counters
+static uint64_t words_executed = 0; // dispatches through NEXT
+static uint64_t next_cycles = 0;
+struct watch {
+    const char *name;
+    bool inclusive;  // count until the function returns, otherwise only cycles spent in its own code
+    uint32_t addr, end;
+    uint64_t calls, cycles;
+    uint32_t return_addr; // while inside an inclusive watch
+    uint64_t entered_at;
+};
+static struct watch watches[] = {
+    { .name = "DOCOL" }, { .name = "EXIT" }, { .name = "LIT" },
+    { .name = "find_word", .inclusive = true }, { .name = "parse_word", .inclusive = true },
+    { .name = "COMMA", .inclusive = true },
+};
+#define WATCH_COUNT (sizeof(watches) / sizeof(watches[0]))
+
+static uint64_t *profile = NULL; // cycles per symbol, with -p
+
+static const char *symbolize(uint32_t addr) {
+    static char buf[128];
+    const struct symbol *s = image_symbol_at(&img, addr);
+    if (!s) return NULL;
+    snprintf(buf, sizeof(buf), "<%s+%u>", s->name, addr - s->addr);
+    return buf;
+}
+
+static void write_string(uint32_t addr) {
+    for (uint8_t ch; (ch = mem_read8(&cpu, addr)); addr++)
+        if (!quiet) putchar(ch);
+}
+
+static bool next_input_line(char *line, size_t size) {
+    while (true) {
+        if (!input) {
+            if (input_next < input_count) {
+                const char *path = inputs[input_next++];
+                input = strcmp(path, "-") ? fopen(path, "r") : stdin;
+                if (!input) {
+                    fprintf(stderr, "cannot open %s\n", path);
+                    exit(2);
+                }
+            } else if (input_count == 0 && input_next++ == 0)
+                input = stdin;
+            else
+                return false;
+        }
+        if (fgets(line, size, input)) {
+            line[strcspn(line, "\r\n")] = 0;
+            return true;
+        }
+        if (input != stdin) fclose(input);
+        input = NULL;
+    }
+}
+
+// The profiler of PICOFORTH_PROFILE builds: the same counts and samples as on the device, with a
+// sample taken every millisecond of emulated time instead of by SysTick
+#define PROFILE_SAMPLE_CYCLES (CPU_MHZ * 1000)
+struct address_counts {
+    uint32_t *flash, *sram; // per halfword
+};
+static struct address_counts forth_counts, forth_samples;
+static uint32_t forth_samples_outside;
+static bool forth_profiling = false;
+static uint64_t next_sample;
+
+static uint32_t *address_count(struct address_counts *t, uint32_t addr) {
+    if (!t->flash) {
+        t->flash = calloc(FLASH_SIZE / 2, sizeof(uint32_t));
+        t->sram = calloc(SRAM_SIZE / 2, sizeof(uint32_t));
+    }
+    if (addr - FLASH_BASE < FLASH_SIZE) return &t->flash[(addr - FLASH_BASE) / 2];
+    if (addr - SRAM_BASE < SRAM_SIZE) return &t->sram[(addr - SRAM_BASE) / 2];
+    return NULL;
+}
+
+static void clear_counts(struct address_counts *t) {
+    if (!t->flash) return;
+    memset(t->flash, 0, FLASH_SIZE / 2 * sizeof(uint32_t));
+    memset(t->sram, 0, SRAM_SIZE / 2 * sizeof(uint32_t));
+}
+
+static bool in_forth_code(uint32_t addr, bool text) {
+    uint32_t text_start = image_symbol(&img, "forth_text_start"), text_end = image_symbol(&img, "forth_text_end");
+    uint32_t core_start = image_symbol(&img, "forth_core_start"), core_end = image_symbol(&img, "forth_core_end");
+    uint32_t library_start = image_symbol(&img, "forth_library_start");
+    uint32_t library_end = image_symbol(&img, "forth_library_end");
+    uint32_t code = image_symbol(&img, "forth_code_area"), dp = mem_read32(&cpu, image_symbol(&img, "forth_vars"));
+    if (text)
+        return (addr >= text_start && addr < text_end) || (addr >= core_start && addr < core_end)
+            || (addr >= library_start && addr < library_end);
+    return addr >= code && addr < dp;
+}
+
+static void profile_sample(uint32_t r5, uint32_t pc) {
+    uint32_t *count = NULL;
+    if (in_forth_code(pc, false)) count = address_count(&forth_samples, pc);
+    else if (in_forth_code(pc, true)) count = address_count(&forth_samples, r5 - 4);
+    if (count) (*count)++;
+    else forth_samples_outside++;
+}
+
+// like profile_owner in picoforth.c, returns the length of the name in *len
+static uint32_t profile_owner(uint32_t addr, uint32_t *len) {
+    if (!in_forth_code(addr, true) && !in_forth_code(addr, false)) return 0;
+    uint32_t best = 0, name = 0;
+    for (uint32_t e = mem_read32(&cpu, image_symbol(&img, "forth_vars") + 12); mem_read32(&cpu, e);
+         e = mem_read32(&cpu, e)) {
+        if (e <= addr && e > best) {
+            best = e;
+            name = e + 5;
+            *len = mem_read8(&cpu, e + 4) & 0x3f;
+        }
+    }
+    for (uint32_t n = image_symbol(&img, "profile_internal_names"); mem_read32(&cpu, n); n += 8) {
+        uint32_t at = mem_read32(&cpu, n) & ~1u;
+        if (at <= addr && at > best) {
+            best = at;
+            name = mem_read32(&cpu, n + 4);
+            *len = strlen((const char *)mem_ptr(&cpu, name, 1));
+        }
+    }
+    return name;
+}
+
+struct profile_word {
+    uint32_t name, len;
+    uint64_t entered, sampled;
+};
+
+static void add_counts(struct profile_word *words, size_t *count, struct address_counts *t, bool sampled) {
+    for (uint32_t i = 0; i < FLASH_SIZE / 2 + SRAM_SIZE / 2; i++) {
+        uint32_t n = i < FLASH_SIZE / 2 ? t->flash[i] : t->sram[i - FLASH_SIZE / 2];
+        if (!n) continue;
+        uint32_t addr = i < FLASH_SIZE / 2 ? FLASH_BASE + 2 * i : SRAM_BASE + 2 * (i - FLASH_SIZE / 2);
+        uint32_t len = 0, name = profile_owner(addr, &len);
+        size_t w;
+        for (w = 0; w < *count && words[w].name != name; w++);
+        if (w == *count) words[(*count)++] = (struct profile_word) { .name = name, .len = len };
+        if (sampled) words[w].sampled += n;
+        else words[w].entered += n;
+    }
+}
+
+static void profile_report(uint32_t n) {
+    static struct profile_word words[4096];
+    size_t count = 0;
+    if (forth_counts.flash) add_counts(words, &count, &forth_counts, false);
+    if (forth_samples.flash) add_counts(words, &count, &forth_samples, true);
+    uint64_t samples = forth_samples_outside;
+    for (size_t w = 0; w < count; w++) samples += words[w].sampled;
+    if (quiet) return;
+    printf("samples %" PRIX64 " in C %X \n", samples, forth_samples_outside);
+    for (; n && count; n--) {
+        size_t top = 0;
+        for (size_t i = 1; i < count; i++)
+            if (words[i].sampled > words[top].sampled
+                || (words[i].sampled == words[top].sampled && words[i].entered > words[top].entered))
+                top = i;
+        if (words[top].name) printf("%.*s ", (int)words[top].len, (const char *)mem_ptr(&cpu, words[top].name, 1));
+        else printf("? ");
+        printf("%" PRIX64 " %" PRIX64 " \n", words[top].sampled, words[top].entered);
+        words[top] = words[--count];
+    }
+}
+
+// source blocks at the same place as with the firmware's default region sizes, filled by -b
+#define BLOCK_SIZE 1024
+#define BLOCK_REGION_SIZE (64 * 1024)
+#define BLOCK_REGION_OFFSET (FLASH_SIZE - 256 * 1024 - BLOCK_REGION_SIZE)
+static uint32_t load_depth = 0, load_lines;
+static uint64_t load_start;
+
+// put the lines of a source file into consecutive blocks, a line never crosses a block
+static void fill_blocks(struct cpu *c, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(2);
+    }
+    char line[BLOCK_SIZE + 1];
+    uint32_t block = 0, at = 0;
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        if (line[len - 1] != '\n') {
+            if (len == BLOCK_SIZE) {
+                fprintf(stderr, "%s: line longer than a block\n", path);
+                exit(2);
+            }
+            line[len++] = '\n';
+        }
+        if (at + len > BLOCK_SIZE) {
+            block++;
+            at = 0;
+        }
+        if ((block + 1) * BLOCK_SIZE > BLOCK_REGION_SIZE) {
+            fprintf(stderr, "%s: too big for the block region\n", path);
+            exit(2);
+        }
+        memcpy(c->flash + BLOCK_REGION_OFFSET + block * BLOCK_SIZE + at, line, len);
+        at += len;
+    }
+    fclose(f);
+}
+
+// The SIO's divider, offsets from SIO_BASE. The result is there right away, the emulated code
+// waits its 8 cycles anyway.
+#define DIV_UDIVIDEND 0x60
+#define DIV_UDIVISOR 0x64
+#define DIV_SDIVIDEND 0x68
+#define DIV_SDIVISOR 0x6c
+#define DIV_QUOTIENT 0x70
+#define DIV_REMAINDER 0x74
+#define DIV_CSR 0x78
+static uint32_t div_dividend, div_divisor, div_quotient, div_remainder;
+
+// same results as the RP2040's divider, also for a divisor of 0
+static void divide(bool is_signed) {
+    if (!div_divisor) {
+        div_quotient = is_signed && (int32_t)div_dividend < 0 ? 1 : 0xffffffff;
+        div_remainder = div_dividend;
+    } else if (!is_signed) {
+        div_quotient = div_dividend / div_divisor;
+        div_remainder = div_dividend % div_divisor;
+    } else if (div_dividend == 0x80000000 && div_divisor == 0xffffffff) {
+        div_quotient = 0x80000000;
+        div_remainder = 0;
+    } else {
+        div_quotient = (uint32_t)((int32_t)div_dividend / (int32_t)div_divisor);
+        div_remainder = (uint32_t)((int32_t)div_dividend % (int32_t)div_divisor);
+    }
+}
+
+static bool io_read(struct cpu *c, uint32_t addr, uint32_t *value) {
+    (void)c;
+    switch (addr - SIO_BASE) {
+    case DIV_UDIVIDEND: case DIV_SDIVIDEND: *value = div_dividend; return true;
+    case DIV_UDIVISOR: case DIV_SDIVISOR: *value = div_divisor; return true;
+    case DIV_QUOTIENT: *value = div_quotient; return true;
+    case DIV_REMAINDER: *value = div_remainder; return true;
+    case DIV_CSR: *value = 1; return true; // ready
+    default: return false;
+    }
+}
+
+static bool io_write(struct cpu *c, uint32_t addr, uint32_t value) {
+    (void)c;
+    switch (addr - SIO_BASE) {
+    case DIV_UDIVIDEND: case DIV_SDIVIDEND: div_dividend = value; break;
+    case DIV_UDIVISOR: case DIV_SDIVISOR: div_divisor = value; break;
+    case DIV_QUOTIENT: div_quotient = value; return true;
+    case DIV_REMAINDER: div_remainder = value; return true;
+    default: return false;
+    }
+    divide(addr - SIO_BASE == DIV_SDIVIDEND || addr - SIO_BASE == DIV_SDIVISOR);
+    return true;
+}
+
+// roughly what configuring a DMA channel through the SDK costs
+#define DMA_SETUP_CYCLES 100
+// the copy or fill is done at once, but dma_wait only returns at the cycle the channel would finish
+static uint64_t dma_done;
+
+// call an emulated function from within a host call, returns r0
+static uint32_t call_emulated(uint32_t addr, uint32_t r0, uint32_t r1);
+
+// host implementations of what picoforth.S calls on the C side, `udf #n` calls hostcalls[n]
+enum {
+    HOST_HALT, HOST_PUT_CHAR, HOST_NEW_LINE, HOST_LCDSTRING, HOST_POLL_LINE,
+    HOST_FLASH_RANGE_PROGRAM, HOST_FLASH_RANGE_ERASE, HOST_BENCH_FIND_WORD, HOST_LCD_STATS,
+    HOST_KEYBOARD_STATS, HOST_SAVE_IMAGE, HOST_DISCARD_IMAGE, HOST_WAIT_INPUT, HOST_TICKS_US,
+    HOST_SET_LED, HOST_PROFILE_COUNT, HOST_PROFILE_SAMPLE, HOST_PROFILE_START, HOST_PROFILE_STOP,
+    HOST_PROFILE_REPORT, HOST_BLOCK_ADDRESS, HOST_BLOCK_LENGTH, HOST_LOAD_BEGIN, HOST_LOAD_END,
+    HOST_NEXT_STATS, HOST_RESET_LOADS, HOST_FORGET_ENTRY, HOST_FORGET_LOOKUP, HOST_PRINT_FREE,
+    HOST_PRINT_FIXED, HOST_DMA_COPY, HOST_DMA_FILL,
+    HOST_SET_LCD_MIRROR, HOST_BOOT_TIME_US, HOST_TYPE_CHARS, HOST_PUT_SPACES, HOST_DMA_WAIT,
+};
+static const char *const hostcalls[] = {
+    "host_halt", "put_char", "new_line", "lcdstring", "poll_line",
+    "flash_program", "flash_erase", "bench_find_word", "lcd_stats",
+    "keyboard_stats", "save_image", "discard_image", "wait_input", "ticks_us",
+    "set_led", "profile_count", "profile_sample", "profile_start", "profile_stop",
+    "profile_report", "block_address", "block_length", "load_begin", "load_end",
+    "next_stats", "reset_loads", "forget_entry", "forget_lookup", "print_free",
+    "print_fixed", "dma_copy", "dma_fill",
+    "set_lcd_mirror", "boot_time_us", "type_chars", "put_spaces", "dma_wait",
+};
+
+static void hostcall(struct cpu *c, uint8_t n) {
+    uint32_t *r = c->r;
+    switch (n) {
+    case HOST_HALT:
+        c->halted = true;
+        break;
+    case HOST_PUT_CHAR:
+        if (!quiet) putchar(r[0] & 0xff);
+        break;
+    case HOST_NEW_LINE:
+        if (!quiet) putchar('\n');
+        break;
+    case HOST_LCDSTRING:
+        write_string(r[0]);
+        break;
+    case HOST_POLL_LINE: { // always a whole line, so the REPL never waits
+        char line[256];
+        if (!next_input_line(line, sizeof(line))) {
+            c->halted = true;
+            break;
+        }
+        size_t len = strlen(line);
+        memcpy(mem_ptr(c, r[0], 1), line, len + 1);
+        if (!quiet) fputs(line, stdout); // echoed on the display as it is typed
+        r[0] = len;
+        break;
+    }
+    case HOST_FLASH_RANGE_PROGRAM:
+        memcpy(c->flash + r[0], mem_ptr(c, r[1], 1), r[2]);
+        break;
+    case HOST_FLASH_RANGE_ERASE:
+        memset(c->flash + r[0], 0xff, r[1]);
+        break;
+    case HOST_BENCH_FIND_WORD: {
+        // same as on the device, but in emulated cycles per lookup instead of lookups per second
+        uint32_t rounds = r[0], latest = r[1];
+        const char *names[] = { "dict_lookup", "dict_lookup_linear" };
+        uint32_t words = 0;
+        for (uint32_t e = latest; mem_read32(c, e); e = mem_read32(c, e))
+            words++;
+        printf("words %u\n", words);
+        for (int l = 0; l < 2; l++) {
+            uint32_t fn = image_symbol(&img, names[l]);
+            uint64_t start = c->cycles;
+            for (uint32_t i = 0; i < rounds; i++)
+                for (uint32_t e = latest; mem_read32(c, e); e = mem_read32(c, e))
+                    call_emulated(fn | 1, e + 5, mem_read8(c, e + 4) & 0x3f);
+            printf("%s cycles/lookup %.1f\n", names[l] + 5,
+                   rounds && words ? (double)(c->cycles - start) / (rounds * words) : 0.0);
+        }
+        break;
+    }
+    case HOST_LCD_STATS:
+    case HOST_KEYBOARD_STATS:
+        if (!quiet) printf("(no display or keyboard on the host) ");
+        break;
+    case HOST_SAVE_IMAGE:
+    case HOST_DISCARD_IMAGE:
+        if (!quiet) printf("(images are not kept on the host) ");
+        break;
+    case HOST_WAIT_INPUT:
+        break;
+    case HOST_TICKS_US:
+        r[0] = (uint32_t)(c->cycles / CPU_MHZ);
+        break;
+    case HOST_SET_LCD_MIRROR: // there is only stdout
+        break;
+    case HOST_BOOT_TIME_US: // the emulator starts right at forth_repl
+        r[0] = 0;
+        break;
+    case HOST_TYPE_CHARS:
+        if (!quiet) fwrite(mem_ptr(c, r[0], 1), 1, r[1], stdout);
+        break;
+    case HOST_PUT_SPACES:
+        if (!quiet) printf("%*s", (int)r[0] > 0 ? (int)r[0] : 0, "");
+        break;
+    case HOST_SET_LED:
+        if (!quiet) printf("(led %s) ", r[0] ? "on" : "off");
+        break;
+    case HOST_PROFILE_COUNT: {
+        uint32_t *count = address_count(&forth_counts, r[0]);
+        if (count) (*count)++;
+        break;
+    }
+    case HOST_PROFILE_SAMPLE: // only called by isr_systick, which never runs here
+        break;
+    case HOST_PROFILE_START:
+        clear_counts(&forth_counts);
+        clear_counts(&forth_samples);
+        forth_samples_outside = 0;
+        forth_profiling = true;
+        next_sample = c->cycles + PROFILE_SAMPLE_CYCLES;
+        break;
+    case HOST_PROFILE_STOP:
+        forth_profiling = false;
+        break;
+    case HOST_PROFILE_REPORT:
+        profile_report(r[0]);
+        break;
+    case HOST_BLOCK_ADDRESS:
+        r[0] = r[0] < BLOCK_REGION_SIZE / BLOCK_SIZE ? FLASH_BASE + BLOCK_REGION_OFFSET + r[0] * BLOCK_SIZE : 0;
+        break;
+    case HOST_BLOCK_LENGTH: { // same as block_length in picoforth.c
+        uint32_t len = 0;
+        if (r[0]) {
+            const uint8_t *block = mem_ptr(c, r[0], BLOCK_SIZE);
+            while (len < BLOCK_SIZE && block[len] != 0xff && block[len]) {
+                if (block[len] == '\n') load_lines++;
+                len++;
+            }
+            if (len && block[len - 1] != '\n') load_lines++;
+        }
+        r[0] = len;
+        break;
+    }
+    case HOST_LOAD_BEGIN:
+        if (!load_depth++) {
+            load_lines = 0;
+            load_start = c->cycles;
+        }
+        break;
+    case HOST_LOAD_END:
+        if (!--load_depth && !quiet) {
+            uint64_t us = (c->cycles - load_start) / CPU_MHZ;
+            printf("\nlines %u lines/s %u (decimal)\n", load_lines, us ? (uint32_t)(load_lines * 1000000ull / us) : 0);
+        }
+        break;
+    case HOST_NEXT_STATS: {
+        uint64_t centicycles = (c->cycles / CPU_MHZ - r[0]) * CPU_MHZ * 100 / ((uint64_t)r[1] * 8);
+        if (!quiet) printf("NEXT %u.%02u cycles\n", (unsigned)(centicycles / 100), (unsigned)(centicycles % 100));
+        break;
+    }
+    case HOST_RESET_LOADS:
+        load_depth = 0;
+        break;
+    case HOST_FORGET_ENTRY: { // same as forget_entry in picoforth.c
+        uint32_t dp = image_symbol(&img, "dp"), end = mem_read32(c, dp), e = r[0];
+        mem_write32(c, dp, e);
+        mem_write32(c, image_symbol(&img, "latest"), mem_read32(c, e));
+        uint32_t operator = image_symbol(&img, "operator_task");
+        for (uint32_t t = operator; mem_read32(c, t) != operator;) {
+            uint32_t next = mem_read32(c, t);
+            if (next >= e && next < end) {
+                mem_write32(c, t, mem_read32(c, next));
+                mem_write32(c, next, 0);
+            } else
+                t = next;
+        }
+        break;
+    }
+    case HOST_FORGET_LOOKUP: {
+        const char *name = (const char *)mem_ptr(c, r[0], 1);
+        uint32_t len = r[1], e;
+        for (e = mem_read32(c, image_symbol(&img, "latest")); mem_read32(c, e); e = mem_read32(c, e))
+            if ((mem_read8(c, e + 4) & 0x3f) == len && !memcmp(mem_ptr(c, e + 5, 1), name, len)) break;
+        const char *error = NULL;
+        if (!mem_read32(c, e)) error = "unknown word";
+        else if (e < image_symbol(&img, "forth_code_area") || e >= image_symbol(&img, "forth_code_end"))
+            error = "predefined word";
+        if (error && !quiet) printf("%s\n", error);
+        r[0] = error ? 0 : e;
+        break;
+    }
+    case HOST_PRINT_FREE: {
+        uint32_t dp = mem_read32(c, image_symbol(&img, "dp"));
+        if (!quiet)
+            printf("used %X free %X \n", dp - image_symbol(&img, "forth_code_area"),
+                   image_symbol(&img, "forth_code_end") - dp);
+        break;
+    }
+    case HOST_PRINT_FIXED: {
+        uint32_t magnitude = (int32_t)r[0] < 0 ? -r[0] : r[0];
+        if (!quiet) printf("%s%X.%04X ", (int32_t)r[0] < 0 ? "-" : "", magnitude >> 16, magnitude & 0xffff);
+        break;
+    }
+    case HOST_DMA_COPY: // a word per cycle after setting up the channel, which runs on its own
+        for (uint32_t i = 0; i < r[2]; i++)
+            mem_write32(c, r[0] + 4 * i, mem_read32(c, r[1] + 4 * i));
+        c->cycles += DMA_SETUP_CYCLES;
+        dma_done = c->cycles + r[2];
+        break;
+    case HOST_DMA_FILL:
+        for (uint32_t i = 0; i < r[2]; i++)
+            mem_write32(c, r[0] + 4 * i, r[1]);
+        c->cycles += DMA_SETUP_CYCLES;
+        dma_done = c->cycles + r[2];
+        break;
+    case HOST_DMA_WAIT:
+        if (c->cycles < dma_done) c->cycles = dma_done;
+        break;
+    default:
+        cpu_fault(c, "unknown hostcall %u", n);
+    }
+}
+
+static void account(uint32_t pc, uint16_t op, uint32_t cycles) {
+    static bool in_next = false;
+    if (op == 0xcd02) { // ldm r5!, {r1}: start of NEXT
+        words_executed++;
+        next_cycles += cycles;
+        in_next = true;
+    } else if (in_next) {
+        if (op == 0x4708) next_cycles += cycles; // bx r1
+        in_next = false;
+    }
+    for (size_t i = 0; i < WATCH_COUNT; i++) {
+        struct watch *w = &watches[i];
+        if (w->inclusive) {
+            if (pc == w->addr && !w->return_addr) {
+                w->calls++;
+                w->return_addr = cpu.r[LR] & ~1u;
+                w->entered_at = cpu.cycles - cycles;
+            }
+        } else if (pc >= w->addr && pc < w->end) {
+            if (pc == w->addr) w->calls++;
+            w->cycles += cycles;
+        }
+    }
+    if (profile) {
+        const struct symbol *s = image_symbol_at(&img, pc);
+        if (s) profile[s - img.symbols] += cycles;
+    }
+}
+
+static void check_returns(uint32_t pc) {
+    for (size_t i = 0; i < WATCH_COUNT; i++) {
+        struct watch *w = &watches[i];
+        if (w->inclusive && w->return_addr == pc) {
+            w->cycles += cpu.cycles - w->entered_at;
+            w->return_addr = 0;
+        }
+    }
+}
+
+static void run(uint64_t limit) {
+    while (!cpu.halted) {
+        uint32_t pc = cpu.r[PC];
+        uint16_t op = mem_read16(&cpu, pc);
+        uint32_t cycles = cpu_step(&cpu);
+        account(pc, op, cycles);
+        check_returns(cpu.r[PC]);
+        if (forth_profiling && cpu.cycles >= next_sample) {
+            profile_sample(cpu.r[5], cpu.r[PC]);
+            next_sample += PROFILE_SAMPLE_CYCLES;
+        }
+        if (limit && cpu.instructions >= limit) {
+            fprintf(stderr, "instruction limit reached\n");
+            cpu.halted = true;
+        }
+    }
+}
+
+static uint32_t halt_stub;
+
+static uint32_t call_emulated(uint32_t addr, uint32_t r0, uint32_t r1) {
+    uint32_t saved[16];
+    memcpy(saved, cpu.r, sizeof(saved));
+    cpu.r[0] = r0;
+    cpu.r[1] = r1;
+    cpu.r[LR] = halt_stub | 1;
+    cpu.r[PC] = addr & ~1u;
+    run(0);
+    cpu.halted = false;
+    uint32_t result = cpu.r[0];
+    memcpy(cpu.r, saved, sizeof(saved));
+    return result;
+}
+
+static int compare_profile(const void *a, const void *b) {
+    uint64_t pa = profile[*(const size_t *)a], pb = profile[*(const size_t *)b];
+    return pa < pb ? 1 : pa > pb ? -1 : 0;
+}
+
+static void report(void) {
+    fprintf(stderr, "instructions %12" PRIu64 "\n", cpu.instructions);
+    fprintf(stderr, "cycles       %12" PRIu64 "\n", cpu.cycles);
+    fprintf(stderr, "words        %12" PRIu64 "\n", words_executed);
+    if (words_executed) {
+        fprintf(stderr, "instr/word   %12.2f\n", (double)cpu.instructions / words_executed);
+        fprintf(stderr, "cycles/word  %12.2f\n", (double)cpu.cycles / words_executed);
+        fprintf(stderr, "NEXT         %12" PRIu64 " cycles %6.2f/dispatch\n", next_cycles,
+                (double)next_cycles / words_executed);
+    }
+    for (size_t i = 0; i < WATCH_COUNT; i++) {
+        struct watch *w = &watches[i];
+        if (!w->addr) continue;
+        fprintf(stderr, "%-12s %12" PRIu64 " cycles %10" PRIu64 " calls %8.2f/call\n", w->name, w->cycles,
+                w->calls, w->calls ? (double)w->cycles / w->calls : 0.0);
+    }
+    if (profile) {
+        size_t *order = malloc(img.symbol_count * sizeof(size_t));
+        for (size_t i = 0; i < img.symbol_count; i++) order[i] = i;
+        qsort(order, img.symbol_count, sizeof(size_t), compare_profile);
+        fprintf(stderr, "\nhottest code:\n");
+        for (size_t i = 0; i < 20 && i < img.symbol_count && profile[order[i]]; i++)
+            fprintf(stderr, "  %-24s %12" PRIu64 " cycles %5.1f%%\n", img.symbols[order[i]].name,
+                    profile[order[i]], 100.0 * profile[order[i]] / cpu.cycles);
+        free(order);
+    }
+}
+
+// one line per word of the code area with its address as a comment
+static void dump_code(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+    uint32_t from = image_symbol(&img, "forth_code_area"), to = mem_read32(&cpu, image_symbol(&img, "dp"));
+    for (uint32_t a = from; a < to; a += 4)
+        fprintf(f, "0x%02x 0x%02x 0x%02x 0x%02x # %08x\n", mem_read8(&cpu, a), mem_read8(&cpu, a + 1),
+                mem_read8(&cpu, a + 2), mem_read8(&cpu, a + 3), a);
+    fclose(f);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-q] [-p] [-l limit] [-d dump] [-b blocks.fs] [-o picoforth.o] [source.fs|-]...\n"
+                    "  -q  no Forth output, only the report\n"
+                    "  -p  add a flat profile of the hottest code to the report\n"
+                    "  -l  stop after this many instructions\n"
+                    "  -d  write the compiled code area to a file, for llvm-mc --disassemble\n"
+                    "  -b  put the lines of a file into the blocks for load and thru\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *object = PICOFORTH_OBJECT;
+    uint64_t limit = 0;
+    bool with_profile = false;
+    const char *dump = NULL;
+    const char *blocks = NULL;
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (!strcmp(argv[i], "-q")) quiet = true;
+        else if (!strcmp(argv[i], "-p")) with_profile = true;
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) limit = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) object = argv[++i];
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) dump = argv[++i];
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) blocks = argv[++i];
+        else usage(argv[0]);
+    }
+    inputs = argv + i;
+    input_count = argc - i;
+
+    cpu_init(&cpu);
+    cpu.flash = malloc(FLASH_SIZE);
+    memset(cpu.flash, 0xff, FLASH_SIZE);
+    cpu.sram = calloc(1, SRAM_SIZE);
+    if (blocks) fill_blocks(&cpu, blocks);
+    cpu.hostcall = hostcall;
+    cpu.symbolize = symbolize;
+    cpu.io_read = io_read;
+    cpu.io_write = io_write;
+    load_object(&cpu, object, hostcalls, sizeof(hostcalls) / sizeof(hostcalls[0]), NULL, 0, &img);
+
+    for (size_t w = 0; w < WATCH_COUNT; w++) {
+        watches[w].addr = image_symbol(&img, watches[w].name);
+        const struct symbol *s = image_symbol_at(&img, watches[w].addr);
+        watches[w].end = s && (size_t)(s - img.symbols) + 1 < img.symbol_count ? s[1].addr : watches[w].addr;
+    }
+    if (with_profile) profile = calloc(img.symbol_count, sizeof(uint64_t));
+
+    halt_stub = img.hostcall_stubs + 2 * HOST_HALT;
+    uint32_t repl = image_symbol(&img, "forth_repl");
+    if (!repl) {
+        fprintf(stderr, "%s: no forth_repl\n", object);
+        return 2;
+    }
+
+    cpu.r[SP] = SRAM_BASE + SRAM_SIZE;
+    cpu.r[LR] = halt_stub | 1;
+    cpu.r[PC] = repl;
+    run(limit);
+    if (!quiet) fputc('\n', stdout);
+    fflush(stdout);
+    report();
+    if (dump) dump_code(dump);
+    return 0;
+}
@@ -0,0 +1,478 @@
+// A Cortex-M0+ (ARMv6-M Thumb) interpreter, just enough of the chip to run picoforth.S
+//
+// Cycle counts follow the Cortex-M0+ TRM assuming zero wait state memory, which is what
+// SRAM and a warm XIP cache give on the RP2040.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thumb.h"
+
+void cpu_init(struct cpu *c) {
+    memset(c->r, 0, sizeof(c->r));
+    c->n = c->z = c->c = c->v = false;
+    c->primask = 0;
+    c->halted = false;
+    c->instructions = 0;
+    c->cycles = 0;
+}
+
+void cpu_fault(struct cpu *c, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "fault: ");
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    const char *sym = c->symbolize ? c->symbolize(c->r[PC]) : NULL;
+    fprintf(stderr, "\n  at pc %08x %s\n", c->r[PC], sym ? sym : "");
+    for (int i = 0; i < 16; i++)
+        fprintf(stderr, "  r%-2d %08x%s", i, c->r[i], i % 4 == 3 ? "\n" : "");
+    exit(2);
+}
+
+uint8_t *mem_ptr(struct cpu *c, uint32_t addr, uint32_t size) {
+    if (addr & (size - 1))
+        cpu_fault(c, "unaligned %u byte access to %08x", size, addr);
+    if (addr >= FLASH_BASE && addr - FLASH_BASE + size <= FLASH_SIZE)
+        return c->flash + (addr - FLASH_BASE);
+    if (addr >= SRAM_BASE && addr - SRAM_BASE + size <= SRAM_SIZE)
+        return c->sram + (addr - SRAM_BASE);
+    return NULL;
+}
+
+static uint32_t io_read(struct cpu *c, uint32_t addr) {
+    uint32_t value;
+    if (!c->io_read || !c->io_read(c, addr, &value))
+        cpu_fault(c, "read from unmapped address %08x", addr);
+    return value;
+}
+
+static void io_write(struct cpu *c, uint32_t addr, uint32_t value) {
+    if (!c->io_write || !c->io_write(c, addr, value))
+        cpu_fault(c, "write of %08x to unmapped address %08x", value, addr);
+}
+
+uint32_t mem_read32(struct cpu *c, uint32_t addr) {
+    uint8_t *p = mem_ptr(c, addr, 4);
+    if (!p) return io_read(c, addr);
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void mem_write32(struct cpu *c, uint32_t addr, uint32_t value) {
+    uint8_t *p = mem_ptr(c, addr, 4);
+    if (!p) {
+        io_write(c, addr, value);
+        return;
+    }
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+uint16_t mem_read16(struct cpu *c, uint32_t addr) {
+    uint8_t *p = mem_ptr(c, addr, 2);
+    if (!p) return io_read(c, addr);
+    return p[0] | p[1] << 8;
+}
+
+static void mem_write16(struct cpu *c, uint32_t addr, uint16_t value) {
+    uint8_t *p = mem_ptr(c, addr, 2);
+    if (!p) {
+        io_write(c, addr, value);
+        return;
+    }
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+uint8_t mem_read8(struct cpu *c, uint32_t addr) {
+    uint8_t *p = mem_ptr(c, addr, 1);
+    if (!p) return io_read(c, addr);
+    return *p;
+}
+
+void mem_write8(struct cpu *c, uint32_t addr, uint8_t value) {
+    uint8_t *p = mem_ptr(c, addr, 1);
+    if (!p) {
+        io_write(c, addr, value);
+        return;
+    }
+    *p = value;
+}
+
+static void set_nz(struct cpu *c, uint32_t v) {
+    c->n = v >> 31;
+    c->z = v == 0;
+}
+
+static uint32_t add_with_carry(struct cpu *c, uint32_t a, uint32_t b, bool carry, bool set_flags) {
+    uint64_t u = (uint64_t)a + b + carry;
+    int64_t s = (int64_t)(int32_t)a + (int32_t)b + carry;
+    uint32_t r = (uint32_t)u;
+    if (set_flags) {
+        set_nz(c, r);
+        c->c = u >> 32;
+        c->v = (int64_t)(int32_t)r != s;
+    }
+    return r;
+}
+
+static bool condition(struct cpu *c, uint8_t cond) {
+    switch (cond) {
+    case 0x0: return c->z;
+    case 0x1: return !c->z;
+    case 0x2: return c->c;
+    case 0x3: return !c->c;
+    case 0x4: return c->n;
+    case 0x5: return !c->n;
+    case 0x6: return c->v;
+    case 0x7: return !c->v;
+    case 0x8: return c->c && !c->z;
+    case 0x9: return !c->c || c->z;
+    case 0xa: return c->n == c->v;
+    case 0xb: return c->n != c->v;
+    case 0xc: return !c->z && c->n == c->v;
+    case 0xd: return c->z || c->n != c->v;
+    default: return true;
+    }
+}
+
+static void branch(struct cpu *c, uint32_t target) {
+    c->r[PC] = target & ~1u;
+}
+
+// interworking branch, picoforth never leaves Thumb state so a clear bit 0 is a bug
+static void branch_exchange(struct cpu *c, uint32_t target) {
+    if (!(target & 1))
+        cpu_fault(c, "branch to ARM state at %08x", target);
+    branch(c, target);
+}
+
+static uint32_t shift_c(struct cpu *c, uint8_t type, uint32_t v, uint32_t amount) {
+    // type 0: LSL, 1: LSR, 2: ASR, 3: ROR, amount as taken from a register
+    if (amount == 0) return v;
+    switch (type) {
+    case 0:
+        if (amount < 32) { c->c = (v >> (32 - amount)) & 1; return v << amount; }
+        c->c = amount == 32 ? v & 1 : 0;
+        return 0;
+    case 1:
+        if (amount < 32) { c->c = (v >> (amount - 1)) & 1; return v >> amount; }
+        c->c = amount == 32 ? v >> 31 : 0;
+        return 0;
+    case 2:
+        if (amount < 32) { c->c = (v >> (amount - 1)) & 1; return (uint32_t)((int32_t)v >> amount); }
+        c->c = v >> 31;
+        return c->c ? 0xffffffffu : 0;
+    default:
+        amount &= 31;
+        if (amount) v = v >> amount | v << (32 - amount);
+        c->c = v >> 31;
+        return v;
+    }
+}
+
+static uint32_t pop_count(uint32_t list) {
+    uint32_t n = 0;
+    for (; list; list >>= 1) n += list & 1;
+    return n;
+}
+
+static uint32_t data_processing(struct cpu *c, uint16_t op) {
+    uint8_t rm = (op >> 3) & 7, rdn = op & 7;
+    uint32_t a = c->r[rdn], b = c->r[rm], r;
+    switch ((op >> 6) & 15) {
+    case 0x0: r = a & b; set_nz(c, r); c->r[rdn] = r; break;                      // ANDS
+    case 0x1: r = a ^ b; set_nz(c, r); c->r[rdn] = r; break;                      // EORS
+    case 0x2: r = shift_c(c, 0, a, b & 0xff); set_nz(c, r); c->r[rdn] = r; break; // LSLS
+    case 0x3: r = shift_c(c, 1, a, b & 0xff); set_nz(c, r); c->r[rdn] = r; break; // LSRS
+    case 0x4: r = shift_c(c, 2, a, b & 0xff); set_nz(c, r); c->r[rdn] = r; break; // ASRS
+    case 0x5: c->r[rdn] = add_with_carry(c, a, b, c->c, true); break;             // ADCS
+    case 0x6: c->r[rdn] = add_with_carry(c, a, ~b, c->c, true); break;            // SBCS
+    case 0x7: r = shift_c(c, 3, a, b & 0xff); set_nz(c, r); c->r[rdn] = r; break; // RORS
+    case 0x8: set_nz(c, a & b); break;                                            // TST
+    case 0x9: c->r[rdn] = add_with_carry(c, ~b, 0, true, true); break;            // RSBS #0
+    case 0xa: add_with_carry(c, a, ~b, true, true); break;                        // CMP
+    case 0xb: add_with_carry(c, a, b, false, true); break;                        // CMN
+    case 0xc: r = a | b; set_nz(c, r); c->r[rdn] = r; break;                      // ORRS
+    case 0xd: r = a * b; set_nz(c, r); c->r[rdn] = r; break;                      // MULS
+    case 0xe: r = a & ~b; set_nz(c, r); c->r[rdn] = r; break;                     // BICS
+    case 0xf: r = ~b; set_nz(c, r); c->r[rdn] = r; break;                         // MVNS
+    }
+    return 1;
+}
+
+// ADD/CMP/MOV with high registers and BX/BLX
+static uint32_t special_data(struct cpu *c, uint16_t op, uint32_t pc) {
+    uint8_t rm = (op >> 3) & 15;
+    uint8_t rd = (op & 7) | ((op >> 4) & 8);
+    uint32_t m = rm == PC ? pc + 4 : c->r[rm];
+    uint32_t d = rd == PC ? pc + 4 : c->r[rd];
+    switch ((op >> 8) & 3) {
+    case 0:
+        if (rd == PC) { branch(c, d + m); return 2; }
+        c->r[rd] = d + m;
+        return 1;
+    case 1:
+        add_with_carry(c, d, ~m, true, true);
+        return 1;
+    case 2:
+        if (rd == PC) { branch(c, m); return 2; }
+        c->r[rd] = m;
+        return 1;
+    default:
+        if (op & 0x80) {
+            c->r[LR] = (pc + 2) | 1;
+            branch_exchange(c, m);
+            return 3;
+        }
+        branch_exchange(c, m);
+        return 2;
+    }
+}
+
+static uint32_t load_store_register(struct cpu *c, uint16_t op) {
+    uint8_t rm = (op >> 6) & 7, rn = (op >> 3) & 7, rt = op & 7;
+    uint32_t addr = c->r[rn] + c->r[rm];
+    switch ((op >> 9) & 7) {
+    case 0: mem_write32(c, addr, c->r[rt]); break;
+    case 1: mem_write16(c, addr, c->r[rt]); break;
+    case 2: mem_write8(c, addr, c->r[rt]); break;
+    case 3: c->r[rt] = (uint32_t)(int8_t)mem_read8(c, addr); break;
+    case 4: c->r[rt] = mem_read32(c, addr); break;
+    case 5: c->r[rt] = mem_read16(c, addr); break;
+    case 6: c->r[rt] = mem_read8(c, addr); break;
+    case 7: c->r[rt] = (uint32_t)(int16_t)mem_read16(c, addr); break;
+    }
+    return 2;
+}
+
+static uint32_t miscellaneous(struct cpu *c, uint16_t op) {
+    if ((op & 0xff00) == 0xb000) { // ADD/SUB SP, #imm7
+        uint32_t imm = (op & 0x7f) << 2;
+        c->r[SP] += op & 0x80 ? -imm : imm;
+        return 1;
+    }
+    if ((op & 0xff00) == 0xb200) { // extend
+        uint32_t m = c->r[(op >> 3) & 7];
+        uint32_t r;
+        switch ((op >> 6) & 3) {
+        case 0: r = (uint32_t)(int16_t)m; break;
+        case 1: r = (uint32_t)(int8_t)m; break;
+        case 2: r = m & 0xffff; break;
+        default: r = m & 0xff; break;
+        }
+        c->r[op & 7] = r;
+        return 1;
+    }
+    if ((op & 0xfe00) == 0xb400) { // PUSH
+        uint32_t list = (op & 0xff) | ((op & 0x100) << 6);
+        uint32_t n = pop_count(list);
+        uint32_t addr = c->r[SP] - 4 * n;
+        c->r[SP] = addr;
+        for (int i = 0; i < 16; i++)
+            if (list & (1u << i)) {
+                mem_write32(c, addr, c->r[i]);
+                addr += 4;
+            }
+        return 1 + n;
+    }
+    if ((op & 0xffef) == 0xb662) { // CPSID/CPSIE i
+        c->primask = (op >> 4) & 1;
+        return 1;
+    }
+    if ((op & 0xff00) == 0xba00) { // REV
+        uint32_t m = c->r[(op >> 3) & 7];
+        uint32_t r;
+        switch ((op >> 6) & 3) {
+        case 0: r = m >> 24 | (m >> 8 & 0xff00) | (m << 8 & 0xff0000) | m << 24; break;
+        case 1: r = (m >> 8 & 0x00ff00ff) | (m << 8 & 0xff00ff00); break;
+        case 3: r = (uint32_t)(int16_t)((m >> 8 & 0xff) | (m << 8 & 0xff00)); break;
+        default: cpu_fault(c, "undefined instruction %04x", op); return 0;
+        }
+        c->r[op & 7] = r;
+        return 1;
+    }
+    if ((op & 0xfe00) == 0xbc00) { // POP
+        uint32_t list = (op & 0xff) | ((op & 0x100) << 7);
+        uint32_t n = pop_count(list);
+        uint32_t addr = c->r[SP];
+        c->r[SP] = addr + 4 * n;
+        for (int i = 0; i < 16; i++)
+            if (list & (1u << i)) {
+                uint32_t v = mem_read32(c, addr);
+                addr += 4;
+                if (i == PC) {
+                    branch_exchange(c, v);
+                    return 3 + n;
+                }
+                c->r[i] = v;
+            }
+        return 1 + n;
+    }
+    if ((op & 0xff00) == 0xbf00) // NOP, YIELD, WFE, WFI, SEV: nothing to wait for in here
+        return 1;
+    cpu_fault(c, "undefined instruction %04x", op);
+    return 0;
+}
+
+static uint32_t load_store_multiple(struct cpu *c, uint16_t op) {
+    uint8_t rn = (op >> 8) & 7;
+    uint32_t list = op & 0xff;
+    uint32_t addr = c->r[rn];
+    uint32_t n = pop_count(list);
+    if (op & 0x0800) { // LDM, writeback unless rn is loaded
+        c->r[rn] = addr + 4 * n;
+        for (int i = 0; i < 8; i++)
+            if (list & (1u << i)) {
+                c->r[i] = mem_read32(c, addr);
+                addr += 4;
+            }
+    } else {
+        for (int i = 0; i < 8; i++)
+            if (list & (1u << i)) {
+                mem_write32(c, addr, c->r[i]);
+                addr += 4;
+            }
+        c->r[rn] = addr;
+    }
+    return 1 + n;
+}
+
+static uint32_t wide(struct cpu *c, uint16_t op, uint32_t pc) {
+    uint16_t op2 = mem_read16(c, pc + 2);
+    if ((op & 0xf800) == 0xf000 && (op2 & 0xd000) == 0xd000) { // BL
+        uint32_t s = (op >> 10) & 1;
+        uint32_t i1 = !(((op2 >> 13) & 1) ^ s);
+        uint32_t i2 = !(((op2 >> 11) & 1) ^ s);
+        uint32_t imm = s << 24 | i1 << 23 | i2 << 22 | (op & 0x3ff) << 12 | (op2 & 0x7ff) << 1;
+        if (s) imm |= 0xfe000000u;
+        c->r[LR] = (pc + 4) | 1;
+        branch(c, pc + 4 + imm);
+        return 3;
+    }
+    if (op == 0xf3bf && (op2 & 0xff00) == 0x8f00) { // DSB, DMB, ISB
+        c->r[PC] = pc + 4;
+        return 3;
+    }
+    if ((op & 0xfff0) == 0xf380 && (op2 & 0xff00) == 0x8800) { // MSR
+        if ((op2 & 0xff) == 0x10) c->primask = c->r[op & 15] & 1;
+        else if ((op2 & 0xff) == 0x08 || (op2 & 0xff) == 0x09) c->r[SP] = c->r[op & 15] & ~3u;
+        c->r[PC] = pc + 4;
+        return 4;
+    }
+    if (op == 0xf3ef && (op2 & 0xf000) == 0x8000) { // MRS
+        uint32_t v = 0;
+        if ((op2 & 0xff) == 0x10) v = c->primask;
+        else if ((op2 & 0xff) == 0x08 || (op2 & 0xff) == 0x09) v = c->r[SP];
+        c->r[(op2 >> 8) & 15] = v;
+        c->r[PC] = pc + 4;
+        return 4;
+    }
+    cpu_fault(c, "undefined instruction %04x %04x", op, op2);
+    return 0;
+}
+
+uint32_t cpu_step(struct cpu *c) {
+    uint32_t pc = c->r[PC];
+    uint16_t op = mem_read16(c, pc);
+    uint32_t cycles = 1;
+    c->r[PC] = pc + 2; // branches overwrite this
+
+    switch (op >> 11) {
+    case 0x00: { // LSLS imm
+        uint32_t imm = (op >> 6) & 31, m = c->r[(op >> 3) & 7];
+        uint32_t r = imm ? shift_c(c, 0, m, imm) : m;
+        set_nz(c, r);
+        c->r[op & 7] = r;
+        break;
+    }
+    case 0x01: // LSRS imm
+    case 0x02: { // ASRS imm
+        uint32_t imm = (op >> 6) & 31, m = c->r[(op >> 3) & 7];
+        uint32_t r = shift_c(c, op >> 11, m, imm ? imm : 32);
+        set_nz(c, r);
+        c->r[op & 7] = r;
+        break;
+    }
+    case 0x03: { // ADDS/SUBS register or imm3
+        uint32_t n = c->r[(op >> 3) & 7];
+        uint32_t m = op & 0x400 ? (op >> 6) & 7 : c->r[(op >> 6) & 7];
+        c->r[op & 7] = op & 0x200 ? add_with_carry(c, n, ~m, true, true)
+                                   : add_with_carry(c, n, m, false, true);
+        break;
+    }
+    case 0x04: c->r[(op >> 8) & 7] = op & 0xff; set_nz(c, op & 0xff); break;
+    case 0x05: add_with_carry(c, c->r[(op >> 8) & 7], ~(uint32_t)(op & 0xff), true, true); break;
+    case 0x06: c->r[(op >> 8) & 7] = add_with_carry(c, c->r[(op >> 8) & 7], op & 0xff, false, true); break;
+    case 0x07: c->r[(op >> 8) & 7] = add_with_carry(c, c->r[(op >> 8) & 7], ~(uint32_t)(op & 0xff), true, true); break;
+    case 0x08:
+        cycles = op & 0x400 ? special_data(c, op, pc) : data_processing(c, op);
+        break;
+    case 0x09: // LDR literal
+        c->r[(op >> 8) & 7] = mem_read32(c, ((pc + 4) & ~3u) + ((op & 0xff) << 2));
+        cycles = 2;
+        break;
+    case 0x0a:
+    case 0x0b:
+        cycles = load_store_register(c, op);
+        break;
+    case 0x0c: mem_write32(c, c->r[(op >> 3) & 7] + (((op >> 6) & 31) << 2), c->r[op & 7]); cycles = 2; break;
+    case 0x0d: c->r[op & 7] = mem_read32(c, c->r[(op >> 3) & 7] + (((op >> 6) & 31) << 2)); cycles = 2; break;
+    case 0x0e: mem_write8(c, c->r[(op >> 3) & 7] + ((op >> 6) & 31), c->r[op & 7]); cycles = 2; break;
+    case 0x0f: c->r[op & 7] = mem_read8(c, c->r[(op >> 3) & 7] + ((op >> 6) & 31)); cycles = 2; break;
+    case 0x10: mem_write16(c, c->r[(op >> 3) & 7] + (((op >> 6) & 31) << 1), c->r[op & 7]); cycles = 2; break;
+    case 0x11: c->r[op & 7] = mem_read16(c, c->r[(op >> 3) & 7] + (((op >> 6) & 31) << 1)); cycles = 2; break;
+    case 0x12: mem_write32(c, c->r[SP] + ((op & 0xff) << 2), c->r[(op >> 8) & 7]); cycles = 2; break;
+    case 0x13: c->r[(op >> 8) & 7] = mem_read32(c, c->r[SP] + ((op & 0xff) << 2)); cycles = 2; break;
+    case 0x14: c->r[(op >> 8) & 7] = ((pc + 4) & ~3u) + ((op & 0xff) << 2); break; // ADR
+    case 0x15: c->r[(op >> 8) & 7] = c->r[SP] + ((op & 0xff) << 2); break;
+    case 0x16:
+    case 0x17:
+        cycles = miscellaneous(c, op);
+        break;
+    case 0x18:
+    case 0x19:
+        cycles = load_store_multiple(c, op);
+        break;
+    case 0x1a:
+    case 0x1b: {
+        uint8_t cond = (op >> 8) & 15;
+        if (cond == 0xe) { // UDF, used for calls into the host
+            if (!c->hostcall)
+                cpu_fault(c, "undefined instruction %04x", op);
+            c->hostcall(c, op & 0xff);
+            if (!c->halted)
+                branch(c, c->r[LR]);
+            break;
+        }
+        if (cond == 0xf)
+            cpu_fault(c, "svc");
+        if (condition(c, cond)) {
+            branch(c, pc + 4 + ((uint32_t)(int8_t)(op & 0xff) << 1));
+            cycles = 2;
+        }
+        break;
+    }
+    case 0x1c: { // B
+        uint32_t imm = (op & 0x7ff) << 1;
+        if (imm & 0x800) imm |= 0xfffff000u;
+        branch(c, pc + 4 + imm);
+        cycles = 2;
+        break;
+    }
+    case 0x1e:
+    case 0x1f:
+        cycles = wide(c, op, pc);
+        break;
+    default:
+        cpu_fault(c, "undefined instruction %04x", op);
+    }
+
+    c->instructions++;
+    c->cycles += cycles;
+    return cycles;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Memory map of the emulated RP2040, only what picoforth touches
+#define FLASH_BASE 0x10000000u
+#define FLASH_SIZE (2 * 1024 * 1024)
+#define SRAM_BASE 0x20000000u
+#define SRAM_SIZE (264 * 1024)
+#define SIO_BASE 0xd0000000u
+
+#define SP 13
+#define LR 14
+#define PC 15
+
+struct cpu;
+
+// called for `udf #n`, which is what calls to host functions are linked against
+typedef void (*hostcall_fn)(struct cpu *c, uint8_t n);
+// reads and writes outside of flash and SRAM, return false to fault
+typedef bool (*io_read_fn)(struct cpu *c, uint32_t addr, uint32_t *value);
+typedef bool (*io_write_fn)(struct cpu *c, uint32_t addr, uint32_t value);
+
+struct cpu {
+    uint32_t r[16];
+    bool n, z, c, v;
+    uint32_t primask;
+
+    uint8_t *flash;
+    uint8_t *sram;
+
+    hostcall_fn hostcall;
+    io_read_fn io_read;
+    io_write_fn io_write;
+    // names an address for fault messages, may be NULL
+    const char *(*symbolize)(uint32_t addr);
+
+    bool halted;
+    uint64_t instructions;
+    uint64_t cycles;
+};
+
+void cpu_init(struct cpu *c);
+// execute one instruction, returns the cycles it took according to the Cortex-M0+ TRM
+uint32_t cpu_step(struct cpu *c);
+void cpu_fault(struct cpu *c, const char *fmt, ...);
+
+uint8_t *mem_ptr(struct cpu *c, uint32_t addr, uint32_t size);
+uint32_t mem_read32(struct cpu *c, uint32_t addr);
+void mem_write32(struct cpu *c, uint32_t addr, uint32_t value);
+uint16_t mem_read16(struct cpu *c, uint32_t addr);
+uint8_t mem_read8(struct cpu *c, uint32_t addr);
+void mem_write8(struct cpu *c, uint32_t addr, uint8_t value);
@@ -0,0 +1,27 @@
+\ Standard words that don't need to be primitives. The metacompiler compiles them into the
+\ firmware, so they are there at power-on, numbers are hex like at the prompt.
+
+: nip ( a b -- b ) swap drop ;
+: tuck ( a b -- b a b ) swap over ;
+: 2dup ( a b -- a b a b ) over over ;
+: 2drop ( a b -- ) drop drop ;
+: 2swap ( a b c d -- c d a b ) rot >r rot r> ;
+: ?dup ( x -- 0 | x x ) dup if dup then ;
+
+: 1+ ( n -- n+1 ) 1 + ;
+: 1- ( n -- n-1 ) 1 - ;
+: 0> ( n -- flag ) 0 > ;
+: 0<> ( x -- flag ) 0= 0= ;
+: within ( n lo hi -- flag ) \ lo <= n < hi, also when the range wraps around
+  over - >r - r> u< ;
+: true ( -- -1 ) 0 invert ;
+: false ( -- 0 ) 0 ;
+
+: cells ( n -- n*4 ) 2* 2* ;
+: cell+ ( addr -- addr+4 ) 4 + ;
+: +! ( n addr -- ) dup @ rot + swap ! ;
+: count ( addr -- addr+1 len ) dup 1+ swap c@ ;
+
+: bl ( -- char ) 20 ;
+: space ( -- ) bl emit ;
+: ? ( addr -- ) @ . ;
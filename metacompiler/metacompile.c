@@ -0,0 +1,465 @@
+// The metacompiler: compiles Forth source on the build machine into an assembler include for
+// picoforth.S, with dictionary headers and threaded code laid out the way `:` compiles them at
+// runtime. The firmware links them into flash after the predefined words, so they are there at
+// power-on without taking any of the code area.
+//
+//   picoforth_metacompiler picoforth.S picoforth_library.S lib/core.fs ...
+//
+// The predefined words (`def_word` lines) and the superinstructions (`fuse_table`) are read from
+// picoforth.S. At the top level only `:`, `variable`, `create`, `allot`, `,`, `hex`, `decimal`,
+// numbers and comments are understood, within definitions the control structures and comments,
+// everything else is compiled as a call. Variables and created buffers are placed in .data.
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LENGTH_MASK 0x3f
+
+struct predefined {
+    char *label;
+    char *name;
+    bool immediate;
+};
+
+struct fusion {
+    char *previous, *next, *fused;
+};
+
+enum word_kind { COLON_WORD, DATA_WORD };
+
+struct library_word {
+    char *name;
+    char *label; // of its code, library_<n>
+    enum word_kind kind;
+};
+
+// a cell of the definition being compiled
+enum cell_kind { CELL_WORD, CELL_NUMBER, CELL_TARGET, CELL_THREAD };
+
+struct cell {
+    enum cell_kind kind;
+    const char *label; // CELL_WORD: what `do` is applied to
+    uint32_t value;    // CELL_NUMBER: the number, CELL_TARGET: a branch label of the definition,
+                       // CELL_THREAD: the library word whose thread a tail call branches into
+};
+
+// control flow while compiling, `if` and `while` leave an orig to resolve, `begin` a dest
+struct control {
+    bool orig;
+    uint32_t label;
+};
+
+static struct predefined *predefined;
+static size_t predefined_count, predefined_capacity;
+static struct fusion *fusions;
+static size_t fusion_count, fusion_capacity;
+static struct library_word *library;
+static size_t library_count, library_capacity;
+
+static struct cell *cells;
+static size_t cell_count, cell_capacity;
+static size_t *label_at; // cell index each branch label is placed at
+static size_t label_count, label_capacity;
+static struct control controls[64];
+static size_t control_depth;
+static size_t fuse_cell, fuse_end = SIZE_MAX; // like fuse_cell and fuse_end in picoforth.S
+
+static uint32_t stack[64]; // numbers at the top level, for `allot` and `,`
+static size_t depth;
+static uint32_t base = 16;
+static bool data_open; // `allot` and `,` still append to the last variable or created buffer
+
+static const char *output_path;
+static FILE *out, *data;
+static const char *source_path;
+static int source_line;
+
+static void fail(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (source_path) fprintf(stderr, "%s:%d: ", source_path, source_line);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+    if (out) {
+        fclose(out);
+        remove(output_path);
+    }
+    exit(1);
+}
+
+static void *grow(void *p, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) return p;
+    *capacity = *capacity ? 2 * *capacity : 64;
+    p = realloc(p, *capacity * size);
+    if (!p) fail("out of memory");
+    return p;
+}
+
+static char *copy(const char *s, size_t len) {
+    char *c = malloc(len + 1);
+    memcpy(c, s, len);
+    c[len] = 0;
+    return c;
+}
+
+// `def_word LABEL,name,flags`, where name may be quoted
+static void read_def_word(const char *p) {
+    const char *comma = strchr(p, ',');
+    if (!comma) return;
+    const char *label = p;
+    while (label < comma && isspace((unsigned char)*label)) label++;
+    char name[LENGTH_MASK + 1];
+    size_t len = 0;
+    p = comma + 1;
+    if (*p == '"') {
+        for (p++; *p && *p != '"'; p++) {
+            if (*p == '\\' && p[1]) p++;
+            if (len < LENGTH_MASK) name[len++] = *p;
+        }
+        if (*p) p++;
+    } else {
+        for (; *p && *p != ',' && !isspace((unsigned char)*p); p++)
+            if (len < LENGTH_MASK) name[len++] = *p;
+    }
+    predefined = grow(predefined, &predefined_capacity, predefined_count, sizeof(*predefined));
+    predefined[predefined_count++] = (struct predefined) {
+        .label = copy(label, comma - label),
+        .name = copy(name, len),
+        .immediate = *p == ',' && strstr(p, "F_IMMEDIATE") != NULL,
+    };
+}
+
+// `.word PREVIOUS + 1, NEXT + 1, FUSED + 1` until `.word 0`
+static bool read_fusion(const char *p) {
+    char *labels[3];
+    for (int i = 0; i < 3; i++) {
+        while (isspace((unsigned char)*p) || *p == ',') p++;
+        const char *start = p;
+        while (isalnum((unsigned char)*p) || *p == '_') p++;
+        if (p == start) return false;
+        labels[i] = copy(start, p - start);
+        while (*p && *p != ',') p++;
+    }
+    fusions = grow(fusions, &fusion_capacity, fusion_count, sizeof(*fusions));
+    fusions[fusion_count++] = (struct fusion) { labels[0], labels[1], labels[2] };
+    return true;
+}
+
+static void read_predefined(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) fail("%s: cannot open", path);
+    char line[512];
+    bool in_fuse_table = false;
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (!strncmp(p, "def_word ", 9)) {
+            read_def_word(p + 9);
+        } else if (!strncmp(p, "fuse_table:", 11)) {
+            in_fuse_table = true;
+        } else if (in_fuse_table) {
+            in_fuse_table = !strncmp(p, ".word ", 6) && read_fusion(p + 6);
+        }
+    }
+    fclose(f);
+    if (!predefined_count) fail("%s: no def_word found", path);
+}
+
+// newest first, like find_word; returns the label for `do` and whether it is immediate
+static const char *find(const char *name, bool *immediate) {
+    *immediate = false;
+    for (size_t i = library_count; i-- > 0;)
+        if (!strcmp(library[i].name, name))
+            return library[i].label;
+    for (size_t i = 0; i < predefined_count; i++)
+        if (!strcmp(predefined[i].name, name)) {
+            *immediate = predefined[i].immediate;
+            return predefined[i].label;
+        }
+    return NULL;
+}
+
+// the library word with code at label, NULL for predefined words
+static const struct library_word *library_word(const char *label) {
+    for (size_t i = 0; i < library_count; i++)
+        if (library[i].label == label)
+            return &library[i];
+    return NULL;
+}
+
+// unlike parse_word, which takes anything it doesn't know as a number, this insists on digits
+static bool parse_number(const char *word, uint32_t *n) {
+    uint32_t value = 0;
+    for (const char *p = word; *p; p++) {
+        int c = toupper((unsigned char)*p);
+        uint32_t digit = isdigit(c) ? (uint32_t)(c - '0') : isupper(c) ? (uint32_t)(c - 'A' + 10) : base;
+        if (digit >= base) return false;
+        value = value * base + digit;
+    }
+    *n = value;
+    return true;
+}
+
+static void emit_name(const char *name) {
+    fputs(".ascii \"", out);
+    for (const char *p = name; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', out);
+        fputc(*p, out);
+    }
+    fputs("\"\n", out);
+}
+
+// the header of the next library word, whose code follows at library_<n>
+static void start_word(const char *name, enum word_kind kind) {
+    size_t len = strlen(name);
+    if (!len) fail("missing name");
+    if (len > LENGTH_MASK) fail("name too long: %s", name);
+    size_t n = library_count;
+    fprintf(out, "\n.align 2\nlibrary_header_%zu:\n", n);
+    if (n) fprintf(out, ".word library_header_%zu\n", n - 1);
+    else fputs(".word latest_predefined\n", out);
+    fprintf(out, ".byte %zu\n", len);
+    emit_name(name);
+    char label[32];
+    snprintf(label, sizeof(label), "library_%zu", n);
+    fprintf(out, ".align 2\n%s:\n", label);
+    library = grow(library, &library_capacity, library_count, sizeof(*library));
+    library[library_count++] = (struct library_word) { copy(name, len), copy(label, strlen(label)), kind };
+}
+
+static void append(struct cell c) {
+    cells = grow(cells, &cell_capacity, cell_count, sizeof(*cells));
+    cells[cell_count++] = c;
+}
+
+static uint32_t new_label(void) {
+    label_at = grow(label_at, &label_capacity, label_count, sizeof(*label_at));
+    label_at[label_count] = SIZE_MAX;
+    return label_count++;
+}
+
+static void place_label(uint32_t label) {
+    label_at[label] = cell_count;
+}
+
+// compile_xt: fuse with the previous instruction if nothing else was compiled since
+static void compile_word(const char *label) {
+    if (fuse_end == cell_count) {
+        for (size_t i = 0; i < fusion_count; i++)
+            if (!strcmp(fusions[i].previous, cells[fuse_cell].label) && !strcmp(fusions[i].next, label)) {
+                cells[fuse_cell].label = fusions[i].fused;
+                return;
+            }
+    }
+    fuse_cell = cell_count;
+    append((struct cell) { CELL_WORD, label, 0 });
+    fuse_end = cell_count;
+}
+
+static void compile_literal(uint32_t n) {
+    fuse_cell = cell_count;
+    append((struct cell) { CELL_WORD, "LIT", 0 });
+    append((struct cell) { CELL_NUMBER, NULL, n });
+    fuse_end = cell_count;
+}
+
+static void compile_branch(const char *label, uint32_t target) {
+    append((struct cell) { CELL_WORD, label, 0 });
+    append((struct cell) { CELL_TARGET, NULL, target });
+}
+
+static struct control pop_control(bool orig, const char *word) {
+    if (!control_depth || controls[control_depth - 1].orig != orig) fail("unbalanced %s", word);
+    return controls[--control_depth];
+}
+
+static void push_control(bool orig, uint32_t label) {
+    if (control_depth == sizeof(controls) / sizeof(*controls)) fail("control structures nested too deep");
+    controls[control_depth++] = (struct control) { orig, label };
+}
+
+// compile_exit: a call to a colon word right before it becomes a branch into its thread, which
+// starts after the `bl forth_library_docol`
+static void finish_colon(void) {
+    if (control_depth) fail("unbalanced control structure at ;");
+    const struct library_word *last = fuse_end == cell_count && fuse_cell + 1 == cell_count
+        ? library_word(cells[fuse_cell].label) : NULL; // not after a literal
+    if (last && last->kind == COLON_WORD) {
+        cells[fuse_cell].label = "BRANCH";
+        append((struct cell) { CELL_THREAD, NULL, last - library });
+    } else {
+        compile_word("EXIT");
+    }
+
+    fputs("    bl forth_library_docol\n", out);
+    for (size_t i = 0; i <= cell_count; i++) {
+        for (size_t l = 0; l < label_count; l++)
+            if (label_at[l] == i) fprintf(out, ".Llibrary_%zu_%zu:\n", library_count - 1, l);
+        if (i == cell_count) break;
+        struct cell *c = &cells[i];
+        if (c->kind == CELL_WORD) fprintf(out, "    do %s\n", c->label);
+        else if (c->kind == CELL_NUMBER) fprintf(out, "    .word 0x%x\n", c->value);
+        else if (c->kind == CELL_THREAD) fprintf(out, "    .word %s + 4\n", library[c->value].label);
+        else fprintf(out, "    .word .Llibrary_%zu_%u\n", library_count - 1, c->value);
+    }
+    cell_count = label_count = 0;
+    fuse_end = SIZE_MAX;
+}
+
+// code that pushes the address of its cells in .data, which `allot` and `,` append to
+static void start_data(const char *name) {
+    start_word(name, DATA_WORD);
+    fprintf(out, "    push {r6}\n    ldr r6, =library_data_%zu\n    NEXT\n.pool\n", library_count - 1);
+    fprintf(data, ".align 2\nlibrary_data_%zu:\n", library_count - 1);
+    data_open = true;
+}
+
+static uint32_t pop(const char *word) {
+    if (!depth) fail("%s needs a number", word);
+    return stack[--depth];
+}
+
+// the next space delimited word of the line at *p, empty at the end of the line
+static const char *next_word(char **p) {
+    while (**p && isspace((unsigned char)**p)) (*p)++;
+    char *start = *p;
+    while (**p && !isspace((unsigned char)**p)) (*p)++;
+    if (**p) *(*p)++ = 0;
+    return start;
+}
+
+static void skip_paren(char **p) {
+    char *end = strchr(*p, ')');
+    *p = end ? end + 1 : *p + strlen(*p);
+}
+
+static void compile_source(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) fail("%s: cannot open", path);
+    source_path = path;
+    source_line = 0;
+    bool compiling = false;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        source_line++;
+        if (!strchr(line, '\n') && !feof(f)) fail("line longer than %zu bytes", sizeof(line) - 2);
+        char *p = line;
+        for (const char *word; *(word = next_word(&p));) {
+            uint32_t n;
+            bool immediate;
+            if (!strcmp(word, "\\")) {
+                break;
+            } else if (!strcmp(word, "(")) {
+                skip_paren(&p);
+            } else if (!compiling) {
+                if (!strcmp(word, ":")) {
+                    start_word(next_word(&p), COLON_WORD);
+                    compiling = true;
+                    data_open = false;
+                } else if (!strcmp(word, "variable")) {
+                    start_data(next_word(&p));
+                    fputs(".word 0\n", data);
+                } else if (!strcmp(word, "create")) {
+                    start_data(next_word(&p));
+                } else if (!strcmp(word, "allot") || !strcmp(word, ",")) {
+                    if (!data_open) fail("%s without variable or create", word);
+                    n = pop(word);
+                    if (*word == ',') fprintf(data, ".word 0x%x\n", n);
+                    else fprintf(data, ".space %u\n", (n + 3) & ~3u);
+                } else if (!strcmp(word, "hex")) {
+                    base = 16;
+                } else if (!strcmp(word, "decimal")) {
+                    base = 10;
+                } else if (parse_number(word, &n)) {
+                    if (depth == sizeof(stack) / sizeof(*stack)) fail("stack overflow");
+                    stack[depth++] = n;
+                } else {
+                    fail("%s can't be run at build time", word);
+                }
+            } else if (!strcmp(word, ";")) {
+                finish_colon();
+                compiling = false;
+            } else if (!strcmp(word, "if")) {
+                uint32_t orig = new_label();
+                compile_branch("ZBRANCH", orig);
+                push_control(true, orig);
+            } else if (!strcmp(word, "else")) {
+                uint32_t orig = new_label();
+                compile_branch("BRANCH", orig);
+                place_label(pop_control(true, word).label);
+                push_control(true, orig);
+            } else if (!strcmp(word, "then")) {
+                fuse_end = SIZE_MAX;
+                place_label(pop_control(true, word).label);
+            } else if (!strcmp(word, "begin")) {
+                fuse_end = SIZE_MAX;
+                uint32_t dest = new_label();
+                place_label(dest);
+                push_control(false, dest);
+            } else if (!strcmp(word, "until") || !strcmp(word, "again")) {
+                compile_branch(word[0] == 'u' ? "ZBRANCH" : "BRANCH", pop_control(false, word).label);
+            } else if (!strcmp(word, "while")) {
+                struct control dest = pop_control(false, word);
+                uint32_t orig = new_label();
+                compile_branch("ZBRANCH", orig);
+                push_control(true, orig);
+                push_control(false, dest.label);
+            } else if (!strcmp(word, "repeat")) {
+                compile_branch("BRANCH", pop_control(false, word).label);
+                fuse_end = SIZE_MAX;
+                place_label(pop_control(true, word).label);
+            } else {
+                const char *label = find(word, &immediate);
+                if (label && immediate) fail("%s isn't supported by the metacompiler", word);
+                if (label) compile_word(label);
+                else if (parse_number(word, &n)) compile_literal(n);
+                else fail("unknown word %s", word);
+            }
+        }
+    }
+    if (compiling) fail("definition not finished at the end of the file");
+    fclose(f);
+    source_path = NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s picoforth.S output.S [source.fs ...]\n", argv[0]);
+        return 2;
+    }
+    read_predefined(argv[1]);
+    output_path = argv[2];
+    out = fopen(output_path, "w");
+    data = tmpfile();
+    if (!out || !data) fail("%s: cannot write", output_path);
+
+    fputs("// generated by picoforth_metacompiler, don't edit\n\n", out);
+    fputs(".pushsection .text.forth_library, \"ax\"\n.align 2\n.global forth_library_start\nforth_library_start:\n", out);
+    // DOCOL is in SRAM, too far for a bl from flash. A bl to this leaves lr at the thread just
+    // like `bl DOCOL` and costs less than a linker veneer, compile_exit knows it as well.
+    fputs("forth_library_docol:\n    ldr r0, =DOCOL\n    bx r0\n.pool\n", out);
+    for (int i = 3; i < argc; i++)
+        compile_source(argv[i]);
+    fputs("\n.global forth_library_end\nforth_library_end:\n.popsection\n\n", out);
+
+    fputs(".pushsection .data\n", out);
+    rewind(data);
+    char buf[4096];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), data));)
+        fwrite(buf, 1, n, out);
+    fputs(".popsection\n\n", out);
+
+    if (library_count) fprintf(out, ".set latest_library, library_header_%zu\n", library_count - 1);
+    else fputs(".set latest_library, latest_predefined\n", out);
+    if (fclose(out)) {
+        out = NULL;
+        fail("%s: cannot write", output_path);
+    }
+    return 0;
+}
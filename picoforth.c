@@ -4,102 +4,291 @@
 #include "hardware/clocks.h"
 #include "hardware/i2c.h"
 #include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "hardware/pio.h"
+#include "hardware/flash.h"
+#include "hardware/structs/systick.h"
+#include "pico/multicore.h"
+#ifdef USB_CONSOLE
+#include "pico/stdio_usb.h"
+#endif
 #include "ps2.pio.h"
 
 #include "tama-mini02-font.h"
-#include "font8x8_basic.h"
+#include "picoforth_tables.h" // generated by tables.cmake
 
 const uint LCDA0_PIN = 13;
 const uint LCDRES_PIN = 12;
 const uint LCDCS1_PIN = 17;
 
-void lcdcommand(uint8_t cmd) {
-    printf("CMD: %x\n", cmd);
-    gpio_put(LCDA0_PIN, 0);
-    spi_write_blocking (spi_default, &cmd, 1);
+#ifndef LCD_SPI_HZ
+#define LCD_SPI_HZ (1000 * 1000)
+#endif
+
+#ifndef INPUT_BUFFER_SIZE
+#define INPUT_BUFFER_SIZE 256 // same as in picoforth.S
+#endif
+
+// The display and the keyboard are serviced by core 1 (see io_service), core 0 only runs Forth.
+// They talk through two of these queues: output from core 0 to core 1 and typed chars back.
+// The SIO FIFOs are left alone because multicore_lockout needs them while writing flash.
+#define SPSC_SIZE 256 // must be a power of two
+struct spsc {
+    volatile uint32_t head; // only written by the producer
+    volatile uint32_t tail; // only written by the consumer
+    uint16_t items[SPSC_SIZE];
+};
+
+bool spsc_push(struct spsc *q, uint16_t item) {
+    if (q->head - q->tail == SPSC_SIZE) return false;
+    q->items[q->head & (SPSC_SIZE - 1)] = item;
+    __dmb(); // item before head
+    q->head++;
+    __sev(); // the other core might wait for it
+    return true;
+}
+
+bool spsc_pop(struct spsc *q, uint16_t *item) {
+    if (q->head == q->tail) return false;
+    __dmb();
+    *item = q->items[q->tail & (SPSC_SIZE - 1)];
+    __dmb(); // item read before the slot is given back
+    q->tail++;
+    __sev();
+    return true;
+}
+
+bool spsc_empty(struct spsc *q) {
+    return q->head == q->tail;
+}
+
+// output items are chars, or this ORed with the char to remove again
+#define OUT_ERASE 0x100
+struct spsc output_queue;
+struct spsc input_queue;
+
+uint32_t lcd_bytes_sent = 0; // everything put on the wire, commands and data
+uint32_t lcd_chars_drawn = 0;
+
+// Display transport: a paint is queued as a list of runs of either command or data bytes which
+// are fed to the SPI by DMA. A0 can only be switched once the last byte of a run has left the
+// SPI. The SPI receives a byte for every one it has shifted out, so a second channel drains the
+// RX FIFO and its completion interrupt switches A0 and starts the next run.
+struct lcd_run {
+    const uint8_t *bytes;
+    uint16_t len;
+    bool is_data;
+};
+#define LCD_MAX_RUNS 16 // a command and a data run per page
+struct lcd_run lcd_runs[LCD_MAX_RUNS];
+uint8_t lcd_run_commands[8][3];
+uint8_t lcd_run_count;
+volatile uint8_t lcd_run_next;
+volatile bool lcd_busy = false;
+int lcd_dma_chan;
+int lcd_rx_chan;
+uint8_t lcd_rx_discard;
+
+void lcd_start_run(const struct lcd_run *run) {
+    gpio_put(LCDA0_PIN, run->is_data);
+    dma_channel_transfer_to_buffer_now(lcd_rx_chan, &lcd_rx_discard, run->len);
+    dma_channel_transfer_from_buffer_now(lcd_dma_chan, run->bytes, run->len);
 }
 
-void lcddata_send(uint8_t cmd) {
-    gpio_put(LCDA0_PIN, 1);
+void lcd_dma_irq() {
+    dma_channel_acknowledge_irq0(lcd_rx_chan);
+    if (lcd_run_next < lcd_run_count)
+        lcd_start_run(&lcd_runs[lcd_run_next++]);
+    else {
+        lcd_busy = false;
+        __sev(); // io_service might wait for it
+    }
+}
+
+void lcd_wait_idle() {
+    while (lcd_busy)
+        tight_loop_contents();
+}
+
+void lcd_transport_init() {
+    lcd_dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(lcd_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, spi_get_dreq(spi_default, true));
+    dma_channel_configure(lcd_dma_chan, &c, &spi_get_hw(spi_default)->dr, NULL, 0, false);
+
+    lcd_rx_chan = dma_claim_unused_channel(true);
+    c = dma_channel_get_default_config(lcd_rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, spi_get_dreq(spi_default, false));
+    dma_channel_configure(lcd_rx_chan, &c, &lcd_rx_discard, &spi_get_hw(spi_default)->dr, 0, false);
+
+    dma_channel_set_irq0_enabled(lcd_rx_chan, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, lcd_dma_irq);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+// blocking, only used while setting up the display
+void lcdcommand(uint8_t cmd) {
+    lcd_wait_idle();
+    gpio_put(LCDA0_PIN, 0);
     spi_write_blocking (spi_default, &cmd, 1);
+    lcd_bytes_sent++;
 }
 
 #define NUM_LINES 16
 const uint8_t LINE_MASK = NUM_LINES - 1;
 uint8_t frame_buffer[NUM_LINES][128]; // 8 lines of 128 columns of 8 pixel height = 64 * 128 bit
 
+// columns [dirty_from, dirty_to) of each frame_buffer line have changed since they were last painted
+uint8_t dirty_from[NUM_LINES];
+uint8_t dirty_to[NUM_LINES];
+uint8_t painted_first_line = 0xff; // frame_buffer line shown on top of the display, 0xff: nothing painted yet
+
+// paints requested within this interval after the last one are merged into a single one, with
+// a USB console attached the display is only a mirror and painted less often
+#define LCD_REFRESH_US 20000
+#define LCD_MIRROR_REFRESH_US 100000
+uint32_t last_paint_us = 0;
+bool paint_pending = false;
+
+void mark_dirty(uint8_t l, uint8_t from, uint8_t to) {
+    if (dirty_from[l] >= dirty_to[l]) {
+        dirty_from[l] = from;
+        dirty_to[l] = to;
+    } else {
+        if (from < dirty_from[l]) dirty_from[l] = from;
+        if (to > dirty_to[l]) dirty_to[l] = to;
+    }
+}
+
 int col = 0;
 void lcddata(uint8_t cmd) {
     uint8_t l = (col >> 7) & LINE_MASK;
-    frame_buffer[l][(col++)&0x7f] = cmd;
+    uint8_t c = col & 0x7f;
+    frame_buffer[l][c] = cmd;
+    col++;
     // if we just wrapped over, delete the rest of the line
-    if ((col & 0x7f) == 1)
-        for (int c = 1; c < 128; c++)
-            frame_buffer[l][c] = 0;
+    if (c == 0) {
+        memset(&frame_buffer[l][1], 0, 127);
+        mark_dirty(l, 0, 128);
+    } else
+        mark_dirty(l, c, c + 1);
 }
-void new_line() {
+void lcd_new_line() {
     uint8_t line = ((col >> 7) + 1) & LINE_MASK;
     col = line << 7;
 }
-void paint_buffer() {
+
+// queue the dirty spans of all visible lines for sending to the display, returns without waiting
+// for the transfer. If the previous one is still running, the paint is left pending.
+void lcd_flush() {
+    if (lcd_busy) {
+        paint_pending = true;
+        return;
+    }
     uint8_t first_line = ((col >> 7) - 7) & LINE_MASK;
-    for (uint8_t l = 0; l < 8; l++) {
-        lcdcommand(0xb0 | l);
-        lcdcommand(0x10); // select column 4
-        lcdcommand(0x04);
-        for (uint8_t c = 0; c < 128; c++)
-            lcddata_send(frame_buffer[(l + first_line) & LINE_MASK][c]);
+    if (first_line != painted_first_line) {
+        // scrolled, every page shows a different line now
+        for (uint8_t l = 0; l < NUM_LINES; l++)
+            mark_dirty(l, 0, 128);
+        painted_first_line = first_line;
+    }
+    lcd_run_count = 0;
+    for (uint8_t p = 0; p < 8; p++) {
+        uint8_t l = (p + first_line) & LINE_MASK;
+        if (dirty_from[l] >= dirty_to[l])
+            continue;
 
+        uint8_t start = dirty_from[l] + 4; // visible area starts at column 4
+        uint8_t *cmds = lcd_run_commands[p];
+        cmds[0] = 0xb0 | p;
+        cmds[1] = 0x10 | (start >> 4);
+        cmds[2] = start & 0xf;
+        lcd_runs[lcd_run_count++] = (struct lcd_run) { cmds, 3, false };
+        // frame_buffer is sent in place, bytes changed while the transfer runs are marked dirty again
+        uint8_t len = dirty_to[l] - dirty_from[l];
+        lcd_runs[lcd_run_count++] = (struct lcd_run) { &frame_buffer[l][dirty_from[l]], len, true };
+        lcd_bytes_sent += 3 + len;
+        dirty_from[l] = dirty_to[l] = 0;
+    }
+    paint_pending = false;
+    last_paint_us = time_us_32();
+    if (lcd_run_count) {
+        lcd_busy = true;
+        lcd_run_next = 1;
+        lcd_start_run(&lcd_runs[0]);
     }
 }
 
+// paint unless the last paint was too recent, returns the microseconds until it's due otherwise
+uint32_t paint_buffer() {
+    uint32_t refresh_us = LCD_REFRESH_US;
+#ifdef USB_CONSOLE
+    if (stdio_usb_connected()) refresh_us = LCD_MIRROR_REFRESH_US;
+#endif
+    uint32_t since = time_us_32() - last_paint_us;
+    if (since < refresh_us) {
+        paint_pending = true; // picked up by io_service once it's due
+        return refresh_us - since;
+    }
+    lcd_flush();
+    return 0;
+}
+
+// index into tama_font, chars the font doesn't have are drawn as '?'
+static inline uint32_t font_index(char c) {
+    uint32_t i = (uint8_t)c - ' ';
+    return i < 96 ? i : '?' - ' ';
+}
+
 void lcdchar(char c) {
-    //const unsigned char *glyph = font8x8_basic_cols[c];
-    const unsigned char *glyph = tama_font[c - ' '];
+    const unsigned char *glyph = tama_font[font_index(c)];
+    lcd_chars_drawn++;
     lcddata(glyph[0]);
     lcddata(glyph[1]);
     if (glyph[2]) lcddata(glyph[2]);
     if (glyph[3]) lcddata(glyph[3]);
     if (glyph[4]) lcddata(glyph[4]);
     lcddata(0);
-    //lcddata(glyph[5]);
-    //lcddata(glyph[6]);
-    //lcddata(glyph[7]);
 }
 uint8_t char_width(char c) {
-    const unsigned char *glyph = tama_font[c - ' '];
-    return 3 + (glyph[2] != 0) + (glyph[3] != 0) + (glyph[4] != 0);
+    return tama_font_width[font_index(c)];
 }
 
-void lcdstring(char *str) {
-    size_t len = strnlen(str, 100);
-    for (int i = 0; i < len; i++)
-        lcdchar(str[i]);
+// remove char c again, which must have been the last one drawn
+void lcd_erase(char c) {
+    uint8_t w = char_width(c);
+    col -= w;
+    for (int i = 0; i < w; i++)
+        lcddata(0);
+    col -= w;
 }
 
-void transpose_font(char (*source_font)[][8], char (*target_font)[][8], int num_chars) {
-    for (int ch = 0; ch < 128; ch++) {
-        for (int col = 0; col < 8; col++) {
-            char c = 0;
-            for (int row = 0; row < 8; row++) {
-                c |= ((((*source_font)[ch][row]) >> col) & 1) << row;
-            }
-            (*target_font)[ch][col] = c;
-        }
-    }
-}
+// The ST7565 wants RES low for at least 1us and is done resetting 1us after it goes high. Its
+// booster and regulators need time to settle before the display is switched on, that happens in
+// io_service once LCD_POWER_SETTLE_US have passed so that it doesn't hold up the boot.
+#define LCD_RESET_US 5
+#define LCD_POWER_SETTLE_US 100000
+uint32_t lcd_power_on_us;
+bool lcd_on = false;
 
 void lcdinit() {
-    transpose_font(&font8x8_basic, &font8x8_basic_cols, 128);
+    lcd_transport_init();
 
     printf("a0: %d res: %d cs: %d\n", LCDA0_PIN, LCDRES_PIN, LCDCS1_PIN);
     gpio_put(LCDCS1_PIN, 0);
 
     gpio_put(LCDRES_PIN, 0);
-    sleep_ms(500);
+    sleep_us(LCD_RESET_US);
     gpio_put(LCDRES_PIN, 1);
-    sleep_ms(1);
+    sleep_us(LCD_RESET_US);
 
     //lcdcommand(0xa5);
     lcdcommand(0xe2); // RESET
@@ -116,82 +305,229 @@ void lcdinit() {
         lcdcommand(0x28 | i); // resistor divider contrast 2 (0..7)
     } */
 
+    lcd_power_on_us = time_us_32();
+
     //lcdstring("Hello");
     //lcdcommand(0xb1);
-    sleep_ms(100);
+    lcd_flush();
+}
 
-    //lcdstring("> ");
+// switch the display on once the power has settled, returns the microseconds until then
+uint32_t lcd_switch_on() {
+    uint32_t since = time_us_32() - lcd_power_on_us;
+    if (since < LCD_POWER_SETTLE_US)
+        return LCD_POWER_SETTLE_US - since;
     lcdcommand(0xaf); // display on
-    paint_buffer();
+    lcd_on = true;
+    return 0;
 }
 
 #define CLOCK_PIN 15
 #define DATA_PIN 14
 
-// mapping generated with scala code, copied from table at https://techdocs.altium.com/display/FPGA/PS2+Keyboard+Scan+Codes
-// val codeMap = "11621e32642552e63673d83e946045-4e=55q15w1de24r2dt2cy35u3ci43o44p4d[54]5b\\5da1cs1bd23f2bg34h33j3bk42l4b;4c'52z1ax22c21v2ab32n31m3a,41.49/4a 29".grouped(3).map { case d => (java.lang.Integer.parseInt(d.tail, 16),d.head) }.toMap
-// (0 until 128).map { i => codeMap.getOrElse(i, '?') }.mkString // needs fixing for escaped chars
-char code_to_char_lower[128] =
-    "?????????????????????q1???zsaw2??cxde43?? vftr5??nbhgy6???mju78??,kio09??./l;p-???'\n[=?????]?\\??????????????????????????????????";
-char code_to_char[128] =
-    "?????????????????????Q!???ZSAW@??CXDE$#?? VFTR%??NBHGY^???MJU&*??<KIO)(??>?L:P_???\"\n{+?????}?|??????????????????????????????????";
+// the output side for core 0, these only wait if core 1 is that far behind
+void put_output(uint16_t item) {
+    while (!spsc_push(&output_queue, item))
+        __wfe();
+}
 
 void put_char(uint8_t ch) {
-    if (ch == '\n') new_line();
-    else lcdchar(ch);
-    paint_buffer();
+    put_output(ch);
+}
+
+void new_line() {
+    put_output('\n');
+}
+
+void lcdstring(char *str) {
+    size_t len = strnlen(str, 100);
+    for (int i = 0; i < len; i++)
+        put_output(str[i]);
 }
 
-void print_number(uint32_t num) {
-    char buffer[100];
-    snprintf(buffer, 100, "%X", num);
+void type_chars(const char *s, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+        put_output(s[i]);
+}
+
+void put_spaces(int32_t n) {
+    for (; n > 0; n--)
+        put_output(' ');
+}
+
+// `u.` in picoforth.S, in the current base
+void print_number(uint32_t num);
+
+// Q16.16 as used by q* and q/, all 4 fractional digits in hex like the integer part
+void print_fixed(int32_t q) {
+    char buffer[16];
+    uint32_t magnitude = q < 0 ? -(uint32_t)q : (uint32_t)q;
+    snprintf(buffer, sizeof(buffer), "%s%X.%04X", q < 0 ? "-" : "", (unsigned)(magnitude >> 16),
+             (unsigned)(magnitude & 0xffff));
     lcdstring(buffer);
     put_char(' ');
-    paint_buffer();
+}
+
+// layout of a dictionary header as written by `def_word` and `:`
+struct dict_entry {
+    struct dict_entry *link;
+    uint8_t size; // length of name, ORed with flags
+    char name[];
+};
+#define LENGTH_MASK 0x3f
+
+uint32_t dict_lookup(const char *name, uint32_t len);
+uint32_t dict_lookup_linear(const char *name, uint32_t len);
+
+// look up every word of the dictionary `rounds` times, once through the hash index and once
+// by walking the list, and print the dictionary size and lookups per second of both
+void bench_find_word(uint32_t rounds, struct dict_entry *latest) {
+    uint32_t words = 0;
+    for (struct dict_entry *e = latest; e->link; e = e->link)
+        words++;
+
+    uint32_t (*lookups[2])(const char *, uint32_t) = { dict_lookup, dict_lookup_linear };
+    uint32_t per_second[2];
+    for (int l = 0; l < 2; l++) {
+        uint32_t start = time_us_32();
+        for (uint32_t r = 0; r < rounds; r++)
+            for (struct dict_entry *e = latest; e->link; e = e->link)
+                lookups[l](e->name, e->size & LENGTH_MASK);
+        uint32_t elapsed = time_us_32() - start;
+        per_second[l] = elapsed ? (uint64_t)rounds * words * 1000000 / elapsed : 0;
+    }
+
+    lcdstring("words ");
+    print_number(words);
+    new_line();
+    lcdstring("hashed/s ");
+    print_number(per_second[0]);
+    new_line();
+    lcdstring("linear/s ");
+    print_number(per_second[1]);
+    new_line();
+}
+
+// print the cycles per dispatch measured by bench-next, n rounds of a thread of 8 words
+void next_stats(uint32_t start_us, uint32_t n) {
+    uint32_t elapsed = time_us_32() - start_us;
+    uint64_t centicycles = (uint64_t)elapsed * (clock_get_hz(clk_sys) / 10000) / ((uint64_t)n * 8);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "NEXT %u.%02u cycles", (unsigned)(centicycles / 100), (unsigned)(centicycles % 100));
+    lcdstring(buffer);
+    new_line();
+}
+
+// print display traffic since the last call, to see what a character costs on the wire
+void lcd_stats() {
+    uint32_t bytes = lcd_bytes_sent, chars = lcd_chars_drawn;
+    lcdstring("lcd bytes ");
+    print_number(bytes);
+    lcdstring("chars ");
+    print_number(chars);
+    new_line();
+    lcdstring("bytes/char ");
+    print_number(chars ? bytes / chars : 0);
+    new_line();
+    lcd_bytes_sent = lcd_chars_drawn = 0;
 }
 
 PIO pio;
 uint sm;
 
-uint8_t read_line(char* buffer) {
-    uint8_t read = 0;
-    bool shift_pressed = false;
-    while(read < 256) {
-        uint8_t code = ps2_program_getc(pio, sm);
-        if (code == 0x5a) { // enter
-            buffer[read] = 0;
-            return read;
+// Keyboard input: frames are drained from the PIO RX FIFO by interrupt and queued as key events,
+// which io_service turns into chars for core 0.
+
+// key events as queued, the scan code in the lower byte
+#define KEY_EXTENDED 0x100 // code was prefixed with 0xe0
+#define KEY_RELEASE 0x200  // break code, i.e. prefixed with 0xf0
+
+struct spsc key_queue; // from the interrupt handler to io_service, both on core 1
+
+uint32_t ps2_parity_errors = 0;
+uint32_t ps2_framing_errors = 0;
+uint32_t key_queue_overflows = 0;
+
+void ps2_irq() {
+    static uint16_t prefix = 0;
+    while (!pio_sm_is_rx_fifo_empty(pio, sm)) {
+        uint32_t frame = ps2_program_get_frame(pio, sm);
+        if (frame == PS2_PARITY_ERROR) {
+            ps2_parity_errors++;
+            prefix = 0;
+            continue;
         }
-        else if (code == 0x59 || code == 0x12) { // right shift / left shift
-            shift_pressed = true;
+        if (frame == PS2_FRAMING_ERROR) {
+            ps2_framing_errors++;
+            prefix = 0;
+            continue;
         }
-        else if (code == 0x66) { // backspace
+
+        uint8_t code = frame >> 24;
+        if (code == 0xe0) prefix |= KEY_EXTENDED;
+        else if (code == 0xf0) prefix |= KEY_RELEASE;
+        else {
+            if (!spsc_push(&key_queue, prefix | code))
+                key_queue_overflows++;
+            prefix = 0;
+        }
+    }
+}
+
+// the char typed with key event ev, '\n' for enter and '\b' for backspace, 0 if none
+char key_to_char(uint16_t ev) {
+    static bool shift_pressed = false;
+    uint8_t code = ev & 0xff;
+    if (code == 0x59 || code == 0x12) // right shift / left shift
+        shift_pressed = !(ev & KEY_RELEASE);
+    else if ((ev & KEY_RELEASE) || code >= 128)
+        return 0;
+    else if (ev & KEY_EXTENDED)
+        return code_to_char_extended[code];
+    else
+        return shift_pressed ? code_to_char[code] : code_to_char_lower[code];
+    return 0;
+}
+
+// Runs on core 0: edits the line in buffer with the chars typed so far, returns its length once
+// enter was pressed and -1 before. The REPL lets other tasks run in between.
+int32_t poll_line(char* buffer) {
+    static uint32_t read = 0;
+    uint16_t ch;
+    while (spsc_pop(&input_queue, &ch)) {
+        if (ch == '\n') { // enter
+            buffer[read] = 0;
+            uint32_t len = read;
+            read = 0;
+            return len;
+        }
+        else if (ch == '\b') { // backspace
             if (read) {
                 read -= 1;
-                uint8_t w = char_width(buffer[read]);
-                col -= w;
-                for (int i = 0; i < w; i++)
-                    lcddata(0);
-                paint_buffer();
-                paint_buffer();
-                col -= w;
+                put_output(OUT_ERASE | (uint8_t)buffer[read]);
             }
         }
-        else if (code < 128) {
-            char ch;
-            if (shift_pressed) ch = code_to_char[code];
-            else ch = code_to_char_lower[code];
-
+        else if (read < INPUT_BUFFER_SIZE - 1) {
             buffer[read++] = ch;
             put_char(ch);
         }
-        else if (code == 0xf0) {
-            // skip release code
-            code = ps2_program_getc(pio, sm);
-            if (code == 0x59 || code == 0x12)
-                shift_pressed = false;
-        }
     }
+    return -1;
+}
+
+// sleep until there is input, for when no other task wants to run
+void wait_input() {
+    while (spsc_empty(&input_queue))
+        __wfe();
+}
+
+// for `ticks` and `ms`, time_us_32 is inline
+uint32_t ticks_us() {
+    return time_us_32();
+}
+
+void set_led(uint32_t on) {
+    gpio_put(PICO_DEFAULT_LED_PIN, on != 0);
 }
 
 void init_keyboard() {
@@ -204,13 +540,640 @@ void init_keyboard() {
     uint offset = pio_add_program(pio, &ps2_program);
     sm = pio_claim_unused_sm(pio, true);
     ps2_program_init(pio, sm, offset, CLOCK_PIN, DATA_PIN);
+
+    pio_set_irq0_source_enabled(pio, pis_sm0_rx_fifo_not_empty + sm, true);
+    irq_set_exclusive_handler(PIO0_IRQ_0, ps2_irq);
+    irq_set_enabled(PIO0_IRQ_0, true);
+}
+
+// print the receive error and overflow counters of the keyboard
+void keyboard_stats() {
+    lcdstring("parity ");
+    print_number(ps2_parity_errors);
+    lcdstring("framing ");
+    print_number(ps2_framing_errors);
+    lcdstring("lost ");
+    print_number(key_queue_overflows);
+    new_line();
+}
+
+// Images: the compiled code and the Forth variables are saved to the end of flash, so that
+// definitions survive a reset. Saves are appended to the region, which is only erased once the
+// next image doesn't fit anymore. On boot the newest complete image is copied back to SRAM.
+
+#ifndef IMAGE_REGION_SIZE
+#define IMAGE_REGION_SIZE (256 * 1024) // multiple of FLASH_SECTOR_SIZE
+#endif
+#define IMAGE_REGION_OFFSET (PICO_FLASH_SIZE_BYTES - IMAGE_REGION_SIZE)
+#define IMAGE_MAGIC 0x46544850 // "PHTF", programmed last, when everything else is in place
+#define IMAGE_ERASED 0xffffffff
+
+// the Forth variables, in the order picoforth.S defines them
+struct forth_vars {
+    uint8_t *dp;
+    uint32_t base;
+    uint32_t state;
+    struct dict_entry *latest;
+    uint32_t native_mode;
+};
+extern struct forth_vars forth_vars;
+extern uint8_t forth_code_area[], forth_code_end[];
+extern const uint8_t forth_text_start[], forth_text_end[]; // the primitives and the compiler
+extern const uint8_t forth_library_start[], forth_library_end[]; // the metacompiled words in flash
+
+struct image_header {
+    uint32_t magic;
+    uint32_t length;      // of the code following the header
+    uint32_t checksum;    // of the code and vars
+    uint32_t fingerprint; // of the firmware that saved the image, images only fit the same one
+    struct forth_vars vars;
+};
+#define IMAGE_PAGES(length) ((sizeof(struct image_header) + (length) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE)
+
+uint32_t fnv1a(uint32_t hash, const uint8_t *bytes, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+        hash = (hash ^ bytes[i]) * 0x01000193;
+    return hash;
+}
+
+// Images contain absolute addresses of primitives and of the code area, so they are only valid
+// for the exact firmware they were saved with.
+uint32_t firmware_fingerprint() {
+    uint32_t hash = fnv1a(0x811c9dc5, forth_text_start, forth_text_end - forth_text_start);
+    hash = fnv1a(hash, forth_library_start, forth_library_end - forth_library_start);
+    uintptr_t code_area = (uintptr_t)forth_code_area;
+    return fnv1a(hash, (const uint8_t *)&code_area, sizeof(code_area));
+}
+
+uint32_t image_checksum(const uint8_t *code, const struct image_header *header) {
+    return fnv1a(fnv1a(0x811c9dc5, code, header->length), (const uint8_t *)&header->vars, sizeof(header->vars));
+}
+
+const struct image_header *image_at(uint32_t offset) {
+    return (const struct image_header *)(XIP_BASE + IMAGE_REGION_OFFSET + offset);
+}
+
+// walks the images in the region, returns the newest valid one (or NULL) and where the next
+// one would go
+const struct image_header *find_image(uint32_t *end) {
+    const struct image_header *newest = NULL;
+    uint32_t fingerprint = firmware_fingerprint();
+    uint32_t offset = 0;
+    while (offset + FLASH_PAGE_SIZE <= IMAGE_REGION_SIZE) {
+        const struct image_header *header = image_at(offset);
+        if (header->length > IMAGE_REGION_SIZE) break; // erased, we are at the end
+        // an interrupted save leaves the magic erased, it is skipped but its pages are used up
+        if (header->magic == IMAGE_MAGIC && header->fingerprint == fingerprint
+            && image_checksum((const uint8_t *)(header + 1), header) == header->checksum)
+            newest = header;
+        offset += IMAGE_PAGES(header->length) * FLASH_PAGE_SIZE;
+    }
+    if (end) *end = offset;
+    return newest;
+}
+
+// Flash can't be read while it is written, so core 1 is parked in RAM and interrupts, whose
+// handlers live in flash, are held off meanwhile. Offsets are from the start of flash.
+void dma_wait();
+
+void flash_program(uint32_t offset, const uint8_t *data, size_t count) {
+    dma_wait(); // data might still be written by a move
+    multicore_lockout_start_blocking();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(offset, data, count);
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+}
+
+void flash_erase(uint32_t offset, size_t count) {
+    multicore_lockout_start_blocking();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(offset, count);
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+}
+
+uint8_t image_page[FLASH_PAGE_SIZE];
+
+void program_image_page(uint32_t offset) {
+    flash_program(IMAGE_REGION_OFFSET + offset, image_page, FLASH_PAGE_SIZE);
+}
+
+// append the current code area and vars as a new image
+void save_image() {
+    dma_wait(); // the checksum covers what a move or fill might still be writing
+    struct image_header header = {
+        .magic = IMAGE_ERASED,
+        .length = forth_vars.dp - forth_code_area,
+        .fingerprint = firmware_fingerprint(),
+        .vars = forth_vars,
+    };
+    header.vars.state = 1; // interpreting, we are being called from a word
+    header.checksum = image_checksum(forth_code_area, &header);
+    uint32_t pages = IMAGE_PAGES(header.length);
+    if (pages * FLASH_PAGE_SIZE > IMAGE_REGION_SIZE) {
+        lcdstring("image too big");
+        new_line();
+        return;
+    }
+
+    uint32_t offset;
+    find_image(&offset);
+    if (offset + pages * FLASH_PAGE_SIZE > IMAGE_REGION_SIZE) {
+        flash_erase(IMAGE_REGION_OFFSET, IMAGE_REGION_SIZE);
+        offset = 0;
+    }
+
+    // the code follows the header directly, so the pages are assembled in image_page
+    for (uint32_t p = 0; p < pages; p++) {
+        memset(image_page, 0xff, FLASH_PAGE_SIZE);
+        uint32_t from = p * FLASH_PAGE_SIZE; // position in the header + code stream
+        uint32_t at = 0;
+        if (p == 0) {
+            memcpy(image_page, &header, sizeof(header));
+            at = sizeof(header);
+        }
+        uint32_t code_from = from + at - sizeof(header);
+        uint32_t n = header.length - code_from;
+        if (n > FLASH_PAGE_SIZE - at) n = FLASH_PAGE_SIZE - at;
+        memcpy(image_page + at, forth_code_area + code_from, n);
+        program_image_page(offset + p * FLASH_PAGE_SIZE);
+    }
+    // only now mark it complete, programming the same page again can only clear more bits
+    memset(image_page, 0xff, FLASH_PAGE_SIZE);
+    header.magic = IMAGE_MAGIC;
+    memcpy(image_page, &header, sizeof(header.magic));
+    program_image_page(offset);
+
+    lcdstring("saved ");
+    print_number(header.length);
+    new_line();
+}
+
+// erase the region, so that the next boot starts from the predefined words only
+void discard_image() {
+    flash_erase(IMAGE_REGION_OFFSET, IMAGE_REGION_SIZE);
+}
+
+// Copy the newest image back to SRAM. Running the code directly from flash isn't possible
+// because it contains absolute addresses of the code area (return addresses into threads,
+// links between headers, `here`), so it would need to be relocated on every boot anyway.
+void restore_image() {
+    uint32_t start = time_us_32();
+    const struct image_header *header = find_image(NULL);
+    if (!header) return;
+    memcpy(forth_code_area, header + 1, header->length);
+    forth_vars = header->vars;
+
+    lcdstring("image ");
+    print_number(header->length);
+    lcdstring("us ");
+    print_number(time_us_32() - start);
+    new_line();
+}
+
+// layout of a task as allotted by `task` (see TASK_* in picoforth.S), the REPL is operator_task
+struct task {
+    struct task *next; // in the round robin, 0 if not running
+    uint32_t sp, rp;
+};
+extern struct task operator_task;
+
+// set here and latest back to just before e, for forget and markers
+void forget_entry(struct dict_entry *e) {
+    uint8_t *end = forth_vars.dp;
+    forth_vars.dp = (uint8_t *)e;
+    forth_vars.latest = e->link;
+    // tasks living in the forgotten part can't run anymore
+    for (struct task *t = &operator_task; t->next != &operator_task;) {
+        struct task *next = t->next;
+        if ((uint8_t *)next >= (uint8_t *)e && (uint8_t *)next < end) {
+            t->next = next->next;
+            next->next = 0;
+        } else
+            t = next;
+    }
+}
+
+// the newest entry with that name if it can be forgotten, otherwise NULL after saying why
+struct dict_entry *forget_lookup(const char *name, uint32_t len) {
+    struct dict_entry *e;
+    for (e = forth_vars.latest; e->link; e = e->link)
+        if ((e->size & LENGTH_MASK) == len && !memcmp(e->name, name, len))
+            break;
+    if (!e->link) {
+        lcdstring("unknown word");
+        new_line();
+        return NULL;
+    }
+    if ((uint8_t *)e < forth_code_area || (uint8_t *)e >= forth_code_end) {
+        lcdstring("predefined word");
+        new_line();
+        return NULL;
+    }
+    return e;
+}
+
+void print_free() {
+    lcdstring("used ");
+    print_number(forth_vars.dp - forth_code_area);
+    lcdstring("free ");
+    print_number(forth_code_end - forth_vars.dp);
+    new_line();
+}
+
+// Blocks: Forth source in flash below the image region, interpreted in place by `load` and
+// `thru`. A block holds lines ending in '\n' up to its first erased byte.
+#ifndef BLOCK_REGION_SIZE
+#define BLOCK_REGION_SIZE (64 * 1024) // multiple of BLOCK_SIZE
+#endif
+#define BLOCK_SIZE 1024
+#define BLOCK_REGION_OFFSET (IMAGE_REGION_OFFSET - BLOCK_REGION_SIZE)
+
+uint32_t load_depth = 0; // loads nested in blocks report as part of the outermost
+uint32_t load_lines;
+uint32_t load_start_us;
+
+// where block n is mapped, 0 if there is no such block
+uint32_t block_address(uint32_t n) {
+    return n < BLOCK_REGION_SIZE / BLOCK_SIZE ? XIP_BASE + BLOCK_REGION_OFFSET + n * BLOCK_SIZE : 0;
+}
+
+// the length of the text of the block at addr, which is about to be loaded
+uint32_t block_length(const char *block) {
+    if (!block) return 0;
+    uint32_t len = 0;
+    while (len < BLOCK_SIZE && block[len] != (char)0xff && block[len]) {
+        if (block[len] == '\n') load_lines++;
+        len++;
+    }
+    if (len && block[len - 1] != '\n') load_lines++;
+    return len;
+}
+
+// an abort leaves the loads it interrupted unfinished
+void reset_loads() {
+    load_depth = 0;
+}
+
+void load_begin() {
+    if (load_depth++) return;
+    load_lines = 0;
+    load_start_us = time_us_32();
+}
+
+// print_number in decimal, whatever `base` the source left behind
+static void print_decimal(uint32_t n) {
+    char buffer[11];
+    char *p = buffer + sizeof(buffer);
+    *--p = 0;
+    do *--p = '0' + n % 10; while (n /= 10);
+    lcdstring(p);
+    put_char(' ');
+}
+
+void load_end() {
+    if (--load_depth) return;
+    uint32_t elapsed = time_us_32() - load_start_us;
+    new_line(); // the report doesn't run into the echoed `load` or `thru`
+    lcdstring("lines ");
+    print_decimal(load_lines);
+    lcdstring("lines/s ");
+    print_decimal(elapsed ? (uint64_t)load_lines * 1000000 / elapsed : 0);
+    lcdstring("(decimal)");
+    new_line();
+}
+
+#ifdef PROFILE
+// Profiling, only in builds with PICOFORTH_PROFILE: NEXT passes every xt it dispatches to to
+// profile_count, and SysTick samples what core 0 runs, by r5 in threaded code and by pc in
+// native code. `.profile` attributes both to dictionary entries.
+#define PROFILE_SLOT_BITS 9
+#define PROFILE_SLOTS (1 << PROFILE_SLOT_BITS) // distinct addresses per table
+#define PROFILE_PROBES 16                      // before an address counts as lost
+#define PROFILE_HZ 1000
+
+struct profile_table {
+    struct {
+        uint32_t addr, count;
+    } slots[PROFILE_SLOTS];
+    uint32_t lost; // counts of addresses that didn't fit anymore
+};
+struct profile_table profile_counts;  // only written by NEXT
+struct profile_table profile_samples; // only written by the SysTick handler
+uint32_t profile_outside = 0;         // samples in C code, where r5 means nothing
+
+// code without dictionary entries, from picoforth.S
+struct profile_name {
+    uint32_t addr;
+    const char *name;
+};
+extern const struct profile_name profile_internal_names[];
+
+extern const uint8_t forth_core_start[], forth_core_end[]; // the inner interpreter
+
+bool in_forth_text(uint32_t addr) {
+    return (addr >= (uintptr_t)forth_text_start && addr < (uintptr_t)forth_text_end)
+        || (addr >= (uintptr_t)forth_core_start && addr < (uintptr_t)forth_core_end)
+        || (addr >= (uintptr_t)forth_library_start && addr < (uintptr_t)forth_library_end);
+}
+
+void profile_add(struct profile_table *t, uint32_t addr) {
+    uint32_t i = (addr * 2654435761u) >> (32 - PROFILE_SLOT_BITS);
+    for (int n = 0; n < PROFILE_PROBES; n++, i = (i + 1) & (PROFILE_SLOTS - 1)) {
+        if (t->slots[i].addr == addr) {
+            t->slots[i].count++;
+            return;
+        }
+        if (!t->slots[i].addr) {
+            t->slots[i].addr = addr;
+            t->slots[i].count = 1;
+            return;
+        }
+    }
+    t->lost++;
+}
+
+void profile_count(uint32_t xt) {
+    profile_add(&profile_counts, xt);
+}
+
+// called by isr_systick with the interrupted r5 and pc
+void profile_sample(uint32_t r5, uint32_t pc) {
+    if (pc >= (uintptr_t)forth_code_area && pc < (uintptr_t)forth_vars.dp)
+        profile_add(&profile_samples, pc); // native code
+    else if (in_forth_text(pc))
+        profile_add(&profile_samples, r5 - 4); // a primitive, r5 is behind its cell in the running thread
+    else
+        profile_outside++;
+}
+
+void profile_start() {
+    memset(&profile_counts, 0, sizeof(profile_counts));
+    memset(&profile_samples, 0, sizeof(profile_samples));
+    profile_outside = 0;
+    systick_hw->csr = 0;
+    systick_hw->rvr = clock_get_hz(clk_sys) / PROFILE_HZ - 1;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_TICKINT_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+}
+
+void profile_stop() {
+    systick_hw->csr = 0;
+}
+
+// the name of the dictionary entry or internal code addr is part of, NULL if it isn't Forth code
+const char *profile_owner(uint32_t addr, uint32_t *len) {
+    if (!in_forth_text(addr) && !(addr >= (uintptr_t)forth_code_area && addr < (uintptr_t)forth_vars.dp))
+        return NULL;
+    uint32_t best = 0;
+    const char *name = NULL;
+    for (struct dict_entry *e = forth_vars.latest; e->link; e = e->link) {
+        if ((uintptr_t)e <= addr && (uintptr_t)e > best) {
+            best = (uintptr_t)e;
+            name = e->name;
+            *len = e->size & LENGTH_MASK;
+        }
+    }
+    for (const struct profile_name *n = profile_internal_names; n->addr; n++) {
+        uint32_t at = n->addr & ~1u;
+        if (at <= addr && at > best) {
+            best = at;
+            name = n->name;
+            *len = strlen(n->name);
+        }
+    }
+    return name;
+}
+
+struct profile_word {
+    const char *name; // NULL for everything that isn't Forth code
+    uint32_t len;
+    uint32_t entered, sampled;
+};
+struct profile_word profile_words[2 * PROFILE_SLOTS + 1];
+
+struct profile_word *profile_word_of(uint32_t addr, uint32_t *count) {
+    uint32_t len = 0;
+    const char *name = profile_owner(addr, &len);
+    for (uint32_t i = 0; i < *count; i++)
+        if (profile_words[i].name == name)
+            return &profile_words[i];
+    profile_words[*count] = (struct profile_word) { .name = name, .len = len };
+    return &profile_words[(*count)++];
+}
+
+// print the n words with the most samples (and then entries) since profile-on
+void profile_report(uint32_t n) {
+    uint32_t count = 0, samples = profile_outside;
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        if (profile_counts.slots[i].addr)
+            profile_word_of(profile_counts.slots[i].addr, &count)->entered += profile_counts.slots[i].count;
+        if (profile_samples.slots[i].addr) {
+            profile_word_of(profile_samples.slots[i].addr, &count)->sampled += profile_samples.slots[i].count;
+            samples += profile_samples.slots[i].count;
+        }
+    }
+
+    lcdstring("samples ");
+    print_number(samples + profile_samples.lost);
+    lcdstring("in C ");
+    print_number(profile_outside);
+    new_line();
+    if (profile_counts.lost || profile_samples.lost) {
+        lcdstring("lost ");
+        print_number(profile_counts.lost);
+        print_number(profile_samples.lost);
+        new_line();
+    }
+    for (; n && count; n--) {
+        uint32_t top = 0;
+        for (uint32_t i = 1; i < count; i++)
+            if (profile_words[i].sampled > profile_words[top].sampled
+                || (profile_words[i].sampled == profile_words[top].sampled
+                    && profile_words[i].entered > profile_words[top].entered))
+                top = i;
+        char name[LENGTH_MASK + 2];
+        if (profile_words[top].name)
+            snprintf(name, sizeof(name), "%.*s ", (int)profile_words[top].len, profile_words[top].name);
+        else
+            strcpy(name, "? ");
+        lcdstring(name);
+        print_number(profile_words[top].sampled);
+        print_number(profile_words[top].entered);
+        new_line();
+        profile_words[top] = profile_words[--count];
+    }
+}
+#endif
+
+// `lcd-mirror`: output is only drawn on the display while this is set
+volatile bool lcd_mirror = true;
+
+void set_lcd_mirror(bool on) {
+    lcd_mirror = on;
+}
+
+#ifdef USB_CONSOLE
+// The REPL as a USB serial port: io_service sends the output there as well as to the display and
+// what the host sends is typed like on the keyboard. stdio_usb services USB from an interrupt on
+// core 0, core 1 polls it every USB_POLL_US while a host is connected.
+#define USB_POLL_US 1000
+#define USB_BUFFER_SIZE 64
+
+char usb_out[USB_BUFFER_SIZE];
+uint32_t usb_out_len = 0;
+char usb_in[USB_BUFFER_SIZE];
+uint32_t usb_in_pos = 0, usb_in_len = 0;
+bool usb_last_cr = false;
+
+void usb_flush() {
+    if (usb_out_len && stdio_usb_connected())
+        stdio_usb.out_chars(usb_out, usb_out_len);
+    usb_out_len = 0;
+}
+
+void usb_output(uint16_t item) {
+    if (usb_out_len + 3 > USB_BUFFER_SIZE)
+        usb_flush();
+    char ch = item & 0xff;
+    if (item & OUT_ERASE) {
+        memcpy(usb_out + usb_out_len, "\b \b", 3);
+        usb_out_len += 3;
+    } else if (ch == '\n') {
+        memcpy(usb_out + usb_out_len, "\r\n", 2);
+        usb_out_len += 2;
+    } else
+        usb_out[usb_out_len++] = ch;
+}
+
+// the next char from the host translated to what key_to_char returns, 0 if there is none
+uint16_t usb_input() {
+    while (true) {
+        if (usb_in_pos == usb_in_len) {
+            int n = stdio_usb.in_chars(usb_in, USB_BUFFER_SIZE);
+            if (n <= 0) return 0;
+            usb_in_pos = 0;
+            usb_in_len = n;
+        }
+        char ch = usb_in[usb_in_pos++];
+        bool after_cr = usb_last_cr;
+        usb_last_cr = ch == '\r';
+        if (ch == '\r') return '\n'; // terminals send cr, files have lf, cr lf is one line
+        if (ch == '\n' && after_cr) continue;
+        if (ch == 0x7f) return '\b';
+        if (ch == '\t') return ' ';
+        if (ch < 0x20 || ch > 0x7e) continue; // like the keymaps: printable ascii only
+        return (uint8_t)ch;
+    }
+}
+#endif
+
+// Core 1: owns frame_buffer, the display and the keyboard. Output from core 0 is drawn as it
+// arrives and painted at most every LCD_REFRESH_US, key events are decoded into input_queue.
+volatile bool io_ready = false;
+
+void io_service() {
+    multicore_lockout_victim_init(); // core 0 stops us while writing flash
+    lcdinit();
+    init_keyboard();
+    io_ready = true;
+
+    uint16_t pending_char = 0; // decoded, but input_queue was full
+    while (true) {
+        uint16_t item;
+        while (spsc_pop(&output_queue, &item)) {
+#ifdef USB_CONSOLE
+            usb_output(item);
+#endif
+            if (!lcd_mirror) continue;
+            char ch = item & 0xff;
+            if (item & OUT_ERASE) lcd_erase(ch);
+            else if (ch == '\n') lcd_new_line();
+            else lcdchar(ch);
+            paint_pending = true;
+        }
+#ifdef USB_CONSOLE
+        usb_flush();
+#endif
+
+        uint16_t ev;
+        while (!pending_char && spsc_pop(&key_queue, &ev))
+            pending_char = key_to_char(ev);
+        if (pending_char && spsc_push(&input_queue, pending_char))
+            pending_char = 0;
+#ifdef USB_CONSOLE
+        // as much as fits, the rest waits in stdio_usb, which holds off the host meanwhile
+        while (!pending_char && (pending_char = usb_input()) && spsc_push(&input_queue, pending_char))
+            pending_char = 0;
+#endif
+
+        uint32_t wait_us = 0;
+        if (paint_pending && !lcd_busy)
+            wait_us = paint_buffer();
+        if (!lcd_on) {
+            uint32_t on_us = lcd_switch_on();
+            if (on_us && (!wait_us || on_us < wait_us))
+                wait_us = on_us;
+        }
+        // any push or pop by core 0 and our interrupt handlers send an event
+        if (!spsc_empty(&output_queue) || (!pending_char && !spsc_empty(&key_queue)))
+            continue;
+#ifdef USB_CONSOLE
+        if (stdio_usb_connected() && (!wait_us || wait_us > USB_POLL_US))
+            wait_us = USB_POLL_US;
+#endif
+        if (wait_us)
+            best_effort_wfe_or_timeout(make_timeout_time_us(wait_us));
+        else
+            __wfe();
+    }
+}
+
+// DMA for big copies and fills by move, fill and friends on core 0. These return once the channel
+// runs, picoforth.S calls dma_wait before the memory is used again.
+int mem_dma_chan;
+uint32_t mem_dma_pattern; // what a fill reads, it outlives the call
+
+void dma_wait() {
+    dma_channel_wait_for_finish_blocking(mem_dma_chan);
+}
+
+void dma_copy(uint32_t *dst, const uint32_t *src, uint32_t words) {
+    dma_wait();
+    dma_channel_config c = dma_channel_get_default_config(mem_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    dma_channel_configure(mem_dma_chan, &c, dst, src, words, true);
+}
+
+void dma_fill(uint32_t *dst, uint32_t pattern, uint32_t words) {
+    dma_wait();
+    mem_dma_pattern = pattern;
+    dma_channel_config c = dma_channel_get_default_config(mem_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    dma_channel_configure(mem_dma_chan, &c, dst, &mem_dma_pattern, words, true);
+}
+
+// microseconds from reset to the first prompt, for `boot-us`
+uint32_t boot_us;
+
+uint32_t boot_time_us() {
+    return boot_us;
 }
 
 void forth_repl();
 void exec_double_test();
 void forth_init() {
-    lcdinit();
-    init_keyboard();
+    mem_dma_chan = dma_claim_unused_channel(true);
+    multicore_launch_core1(io_service);
+    while (!io_ready)
+        tight_loop_contents();
+    restore_image();
+    boot_us = time_us_32();
     //exec_double_test();
 
     while(true)
@@ -230,7 +1193,7 @@ int main() {
     gpio_init(PICO_DEFAULT_LED_PIN);
     gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
     
-    spi_init(spi_default, 1000 * 1000);
+    spi_init(spi_default, LCD_SPI_HZ);
     gpio_set_function(PICO_DEFAULT_SPI_SCK_PIN, GPIO_FUNC_SPI);
     gpio_set_function(PICO_DEFAULT_SPI_TX_PIN, GPIO_FUNC_SPI);
 
@@ -0,0 +1,134 @@
+# Generates the constant tables picoforth.c would otherwise compute at boot or keep in RAM:
+#
+#   cmake -DSOURCE_DIR=<repo> -DOUTPUT=<header> -P tables.cmake
+#
+# - tama_font_width: columns each glyph of tama-mini02-font.h takes, as drawn by lcdchar
+# - code_to_char_lower, code_to_char, code_to_char_extended: PS/2 scan code set 2 to chars
+
+# a char followed by its scan code, see https://techdocs.altium.com/display/FPGA/PS2+Keyboard+Scan+Codes
+set(keys "11621e32642552e63673d83e946045-4e=55q15w1de24r2dt2cy35u3ci43o44p4d[54]5b\\5da1cs1bd23f2bg34h33j3bk42l4b;4c'52z1ax22c21v2ab32n31m3a,41.49/4a 29`0e")
+# the keypad types the same with and without shift
+set(keypad "07016927237a46b57367476c87597d.71+79-7b*7c")
+# what the keys above type with shift, pairs of chars, letters are just upper cased
+set(shifted "1!2@3#4$5%6^7&8*9(0)-_=+[{]}\\|;:'\",<.>/?`~")
+# the ones that aren't printable, tab types a space
+set(enter 90)     # 0x5a, also with the extended prefix for the keypad's enter
+set(backspace 102) # 0x66
+set(tab 13)       # 0x0d
+set(keypad_slash 74) # 0x4a with the extended prefix
+
+# the bytes of each `{ 0x.., ... }` row in a font header, as a list of comma separated rows
+function(read_font path out)
+    file(READ ${path} content)
+    string(REGEX MATCHALL "{ *0x[0-9A-Fa-f]+[^}]*}" rows "${content}")
+    set(result)
+    foreach(row ${rows})
+        string(REGEX MATCHALL "0x[0-9A-Fa-f]+" bytes "${row}")
+        string(REPLACE ";" "," bytes "${bytes}")
+        list(APPEND result "${bytes}")
+    endforeach()
+    set(${out} "${result}" PARENT_SCOPE)
+endfunction()
+
+# a C char literal for ch
+function(char_literal ch out)
+    if(ch STREQUAL "\\")
+        set(${out} "'\\\\'" PARENT_SCOPE)
+    elseif(ch STREQUAL "'")
+        set(${out} "'\\''" PARENT_SCOPE)
+    else()
+        set(${out} "'${ch}'" PARENT_SCOPE)
+    endif()
+endfunction()
+
+# `name[128]` from the variables <prefix>_<code>, 0 where there is none
+function(keymap_table name prefix out)
+    set(table "const char ${name}[128] = {")
+    foreach(code RANGE 127)
+        math(EXPR column "${code} % 16")
+        if(column EQUAL 0)
+            string(APPEND table "\n   ")
+        endif()
+        if(DEFINED ${prefix}_${code})
+            string(APPEND table " ${${prefix}_${code}},")
+        else()
+            string(APPEND table " 0,")
+        endif()
+    endforeach()
+    set(${out} "${table}\n};\n" PARENT_SCOPE)
+endfunction()
+
+set(header "// generated by tables.cmake, don't edit\n\n")
+
+read_font(${SOURCE_DIR}/tama-mini02-font.h tama)
+string(APPEND header "// the first two columns of a glyph are always drawn, the next three unless they're empty,\n")
+string(APPEND header "// then one to separate it from the next\n")
+string(APPEND header "const uint8_t tama_font_width[96] = {")
+set(index 0)
+foreach(glyph ${tama})
+    string(REPLACE "," ";" columns "${glyph}")
+    set(width 3)
+    foreach(i 2 3 4)
+        list(GET columns ${i} column)
+        if(NOT column EQUAL 0)
+            math(EXPR width "${width} + 1")
+        endif()
+    endforeach()
+    math(EXPR column "${index} % 16")
+    if(column EQUAL 0)
+        string(APPEND header "\n   ")
+    endif()
+    string(APPEND header " ${width},")
+    math(EXPR index "${index} + 1")
+endforeach()
+string(APPEND header "\n};\n\n")
+
+string(LENGTH "${keys}" length)
+math(EXPR last "${length} - 3")
+foreach(i RANGE 0 ${last} 3)
+    string(SUBSTRING "${keys}" ${i} 1 ch)
+    math(EXPR at "${i} + 1")
+    string(SUBSTRING "${keys}" ${at} 2 hex)
+    math(EXPR code "0x${hex}")
+    char_literal("${ch}" lower_${code})
+    if(ch MATCHES "[a-z]")
+        string(TOUPPER "${ch}" upper)
+    else()
+        string(FIND "${shifted}" "${ch}" pos)
+        if(pos EQUAL -1)
+            set(upper "${ch}")
+        else()
+            math(EXPR pos "${pos} + 1")
+            string(SUBSTRING "${shifted}" ${pos} 1 upper)
+        endif()
+    endif()
+    char_literal("${upper}" upper_${code})
+endforeach()
+string(LENGTH "${keypad}" length)
+math(EXPR last "${length} - 3")
+foreach(i RANGE 0 ${last} 3)
+    string(SUBSTRING "${keypad}" ${i} 1 ch)
+    math(EXPR at "${i} + 1")
+    string(SUBSTRING "${keypad}" ${at} 2 hex)
+    math(EXPR code "0x${hex}")
+    char_literal("${ch}" lower_${code})
+    set(upper_${code} ${lower_${code}})
+endforeach()
+foreach(prefix lower upper)
+    set(${prefix}_${enter} "'\\n'")
+    set(${prefix}_${backspace} "'\\b'")
+    set(${prefix}_${tab} "' '")
+endforeach()
+set(extended_${enter} "'\\n'")
+set(extended_${keypad_slash} "'/'")
+
+string(APPEND header "// PS/2 scan code set 2 to chars, 0 for keys that don't type one\n")
+keymap_table(code_to_char_lower lower table)
+string(APPEND header "${table}")
+keymap_table(code_to_char upper table)
+string(APPEND header "${table}")
+string(APPEND header "// keys sent with the 0xe0 prefix\n")
+keymap_table(code_to_char_extended extended table)
+string(APPEND header "${table}")
+
+file(WRITE ${OUTPUT} "${header}")